@@ -0,0 +1,135 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ALIGN_UP(x) (((x) + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1))
+#define BLOCK_HDR ALIGN_UP(sizeof(arena_block_t))
+#define BLOCK_DATA(b) ((char*)(b) + BLOCK_HDR)
+
+static arena_block_t* arena_block_create(size_t size) {
+    arena_block_t *b = malloc(BLOCK_HDR + size);
+    if(!b) {
+        perror("malloc");
+        return NULL;
+    }
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+arena_t* arena_create(size_t block_size) {
+    arena_t *arena = malloc(sizeof(arena_t));
+    if(!arena) {
+        perror("malloc");
+        return NULL;
+    }
+
+    arena->block_size = ALIGN_UP(block_size);
+    arena->last = NULL;
+    arena->block = arena_block_create(arena->block_size);
+    if(!arena->block) {
+        free(arena);
+        return NULL;
+    }
+
+    return arena;
+}
+
+void* arena_alloc(arena_t *arena, size_t size) {
+    arena_block_t *b = arena->block;
+    size = ALIGN_UP(size);
+
+    if(b->size - b->used >= size) {
+        void *ptr = BLOCK_DATA(b) + b->used;
+        b->used += size;
+        arena->last = ptr;
+        return ptr;
+    }
+
+    // big objects get their own block behind the current one,
+    // so the rest of the current block is not wasted
+    if(size > arena->block_size/4) {
+        arena_block_t *big = arena_block_create(size);
+        if(!big)
+            return NULL;
+        big->used = size;
+        big->next = b->next;
+        b->next = big;
+        return BLOCK_DATA(big);
+    }
+
+    b = arena_block_create(arena->block_size);
+    if(!b)
+        return NULL;
+    b->next = arena->block;
+    arena->block = b;
+    b->used = size;
+    arena->last = BLOCK_DATA(b);
+    return arena->last;
+}
+
+void* arena_calloc(arena_t *arena, size_t num, size_t size) {
+    void *ptr = arena_alloc(arena, num*size);
+    if(ptr)
+        memset(ptr, 0, num*size);
+    return ptr;
+}
+
+// the most recent allocation grows in place while the block has room
+void* arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t new_size) {
+    arena_block_t *b = arena->block;
+
+    if(ptr && ptr == arena->last) {
+        size_t off = (char*)ptr - BLOCK_DATA(b);
+        if(b->size - off >= ALIGN_UP(new_size)) {
+            b->used = off + ALIGN_UP(new_size);
+            return ptr;
+        }
+    }
+
+    if(new_size <= old_size)
+        return ptr;
+
+    void *new_ptr = arena_alloc(arena, new_size);
+    if(!new_ptr)
+        return NULL;
+    if(ptr)
+        memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+char* arena_strndup(arena_t *arena, const char *str, size_t len) {
+    char *dup = arena_alloc(arena, len+1);
+    if(!dup)
+        return NULL;
+    memcpy(dup, str, len);
+    dup[len] = 0;
+    return dup;
+}
+
+// keeps the current block, so a reused arena doesn't go back to malloc
+void arena_reset(arena_t *arena) {
+    arena_block_t *b = arena->block->next, *tmp;
+    while(b) {
+        tmp = b->next;
+        free(b);
+        b = tmp;
+    }
+    arena->block->next = NULL;
+    arena->block->used = 0;
+    arena->last = NULL;
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *b = arena->block, *tmp;
+    while(b) {
+        tmp = b->next;
+        free(b);
+        b = tmp;
+    }
+    free(arena);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct arena_block_s {
+    struct arena_block_s *next;
+    size_t               size;
+    size_t               used;
+} arena_block_t;
+
+// Region allocator: objects are never freed one by one, arena_free
+// releases everything at once.
+typedef struct {
+    arena_block_t *block;
+    size_t        block_size;
+    void          *last;
+} arena_t;
+
+arena_t* arena_create(size_t block_size);
+void* arena_alloc(arena_t *arena, size_t size);
+void* arena_calloc(arena_t *arena, size_t num, size_t size);
+void* arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+char* arena_strndup(arena_t *arena, const char *str, size_t len);
+void arena_reset(arena_t *arena);
+void arena_free(arena_t *arena);
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Synthetic .trans files for the benchmark. Every kind of grammar grows
+// with n, the same n and kind always give the same file.
+
+static uint64_t rnd_state = 88172645463325252ULL;
+
+static uint32_t rnd(uint32_t n) {
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state % n;
+}
+
+static void word(char *buf, int min_len, int max_len, int alphabet) {
+    int len = min_len + rnd(max_len - min_len + 1);
+    for(int i = 0; i < len; i++)
+        buf[i] = 'a' + rnd(alphabet);
+    buf[len] = 0;
+}
+
+// distinct keywords and an identifier rule, like in most languages
+static void gen_keywords(size_t n) {
+    char buf[16];
+    for(size_t i = 0; i < n; i++) {
+        word(buf, 3, 10, 26);
+        printf("\"%s%lu\" { return %lu; }\n", buf, i, i+2);
+    }
+    puts("\"[a-z_][a-z0-9_]*\" { return 1; }");
+}
+
+// rules with a fixed prefix followed by an identifier tail
+static void gen_idents(size_t n) {
+    char buf[16];
+    for(size_t i = 0; i < n; i++) {
+        word(buf, 1, 4, 26);
+        printf("\"%s%lu_[a-zA-Z0-9]+\" { return %lu; }\n", buf, i, i+1);
+    }
+}
+
+static void gen_alt_tree(int depth) {
+    char buf[16];
+    if(depth == 0) {
+        word(buf, 1, 3, 8);
+        fputs(buf, stdout);
+        return;
+    }
+    putchar('(');
+    gen_alt_tree(depth-1);
+    putchar('|');
+    gen_alt_tree(depth-1);
+    putchar(')');
+}
+
+// nested alternations of short words
+static void gen_alt(size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        printf("\"%lu", i);
+        gen_alt_tree(1 + rnd(4));
+        printf("\" { return %lu; }\n", i+1);
+    }
+}
+
+// stars over a small alphabet, these make subset construction work hard
+static void gen_star(size_t n) {
+    char buf[16];
+    for(size_t i = 0; i < n; i++) {
+        printf("\"");
+        int parts = 2 + rnd(3);
+        for(int p = 0; p < parts; p++) {
+            word(buf, 1, 3, 4);
+            switch(rnd(3)) {
+                case 0: printf("%s", buf); break;
+                case 1: printf("(%s)*", buf); break;
+                case 2: printf("[%s]+", buf); break;
+            }
+        }
+        printf("\" { return %lu; }\n", i+1);
+    }
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        void (*gen)(size_t);
+    } kinds[] = {
+        { "keywords", gen_keywords },
+        { "idents",   gen_idents   },
+        { "alt",      gen_alt      },
+        { "star",     gen_star     },
+    };
+
+    if(argc != 3) {
+        fprintf(stderr, "Usage: %s keywords|idents|alt|star <n>\n", argv[0]);
+        return 1;
+    }
+
+    size_t n = strtoul(argv[2], NULL, 10);
+    for(size_t i = 0; i < sizeof(kinds)/sizeof(*kinds); i++) {
+        if(strcmp(argv[1], kinds[i].name))
+            continue;
+        puts("[header]");
+        puts("typedef struct { int class; char *str; size_t str_len; } lexeme_t;");
+        puts("");
+        puts("[regexes]");
+        kinds[i].gen(n);
+        puts("\"[ \\t\\n]+\" { return 0; }");
+        return 0;
+    }
+
+    fprintf(stderr, "Unknown grammar kind: %s\n", argv[1]);
+    return 1;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Runs trans on synthetic grammars of growing size and prints one line
+# per grammar: sizes, time and peak RSS of every phase, output size.
+#
+# usage: bench/run.sh [trans options]
+# KINDS and SIZES environment variables override the defaults.
+
+set -e
+
+dir=$(dirname "$0")
+trans="$dir/../trans"
+gen="$dir/gen_trans"
+kinds=${KINDS:-"keywords idents alt star"}
+sizes=${SIZES:-"100 200 400 800 1600 3200"}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf "%-9s %6s %9s %7s %7s %11s %9s %11s %8s %9s %8s %8s\n" \
+    kind n positions states min get_stat_ms to_dfa_ms minimize_ms gen_c_ms total_ms rss_kb out_kb
+
+for kind in $kinds; do
+    for n in $sizes; do
+        "$gen" "$kind" "$n" > "$tmp/bench.trans"
+        rm -f "$tmp/bench.c" "$tmp/bench.h"
+        "$trans" -s "$@" "$tmp/bench.trans" 2>"$tmp/err" | awk -v kind="$kind" -v n="$n" '
+            $1 == "stats:" && $2 == "phase" { ms[$3] = $4; rss = $6 }
+            $1 == "stats:" && $2 == "positions" { pos = $3 }
+            $1 == "stats:" && $2 == "dfa_states" { states = $3 }
+            $1 == "stats:" && $2 == "min_states" { min = $3 }
+            $1 == "stats:" && $2 == "output" { out = $3 }
+            $1 == "stats:" && $2 == "total" { total = $3 }
+            END {
+                if(total == "") {
+                    printf "%-9s %6d failed\n", kind, n
+                    exit
+                }
+                printf "%-9s %6d %9d %7d %7d %11.1f %9.1f %11.1f %8.1f %9.1f %8d %8d\n",
+                       kind, n, pos, states, min, ms["get_regexp_stat"], ms["regexp_to_dfa"],
+                       ms["dfa_minimize"], ms["gen_c_file"], total, rss, out/1024
+            }'
+    done
+done
@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "TRANSDFA"
+// bump when the cache file layout or DFA construction changes
+#define CACHE_VERSION 4
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t num_classes;
+    uint64_t key_len;
+    uint64_t num_states;
+} cache_hdr_t;
+
+static bool key_append(arena_t *arena, cache_key_t *key, size_t *max_len, const void *data, size_t len) {
+    if(key->key_len + len > *max_len) {
+        size_t new_max = *max_len;
+        while(new_max < key->key_len + len)
+            new_max <<= 1;
+        char *tmp = arena_realloc(arena, key->key, *max_len, new_max);
+        if(!tmp)
+            return false;
+        key->key = tmp;
+        *max_len = new_max;
+    }
+    memcpy(key->key + key->key_len, data, len);
+    key->key_len += len;
+    return true;
+}
+
+// FNV-1a
+static uint64_t key_hash(const char *key, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// actions and whitespace don't affect the DFA, so only regexes are hashed
+bool cache_make_key(arena_t *arena, regexp_func_t *funcs, size_t num_funcs, const char *options, cache_key_t *key) {
+    size_t max_len = 256;
+    uint64_t len;
+
+    key->key_len = 0;
+    key->key = arena_alloc(arena, max_len);
+    if(!key->key)
+        return false;
+
+    if(!key_append(arena, key, &max_len, options, strlen(options)+1))
+        return false;
+    for(size_t i = 0; i < num_funcs; i++) {
+        len = funcs[i].regexp_len;
+        if(!key_append(arena, key, &max_len, &len, sizeof(len)) ||
+           !key_append(arena, key, &max_len, funcs[i].regexp, len))
+            return false;
+    }
+
+    key->hash = key_hash(key->key, key->key_len);
+    return true;
+}
+
+static char* cache_path(arena_t *arena, const char *dir, cache_key_t *key) {
+    size_t len = strlen(dir) + 22;
+    char *path = arena_alloc(arena, len);
+    if(path)
+        snprintf(path, len, "%s/%016llx.dfa", dir, (unsigned long long)key->hash);
+    return path;
+}
+
+dfa_t* cache_load(arena_t *arena, const char *dir, cache_key_t *key, regexp_func_t *funcs, size_t num_funcs, uint32_t *hosts) {
+    FILE *fd = NULL;
+    dfa_t *dfa = NULL;
+    cache_hdr_t hdr;
+    char *stored_key;
+    uint32_t *targets, *stored_hosts;
+    size_t num_entries;
+
+    char *path = cache_path(arena, dir, key);
+    if(!path)
+        return NULL;
+
+    // any failure below is a cache miss
+    fd = fopen(path, "rb");
+    if(!fd)
+        return NULL;
+
+    if(fread(&hdr, sizeof(hdr), 1, fd) != 1 ||
+       memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) ||
+       hdr.version != CACHE_VERSION ||
+       hdr.key_len != key->key_len ||
+       hdr.num_classes == 0 || hdr.num_classes > 256 ||
+       hdr.num_states == 0 || hdr.num_states > INT_MAX)
+        goto exit;
+
+    stored_key = arena_alloc(arena, hdr.key_len);
+    if(!stored_key ||
+       fread(stored_key, 1, hdr.key_len, fd) != hdr.key_len ||
+       memcmp(stored_key, key->key, hdr.key_len))
+        goto exit;
+
+    num_entries = hdr.num_states*hdr.num_classes;
+    dfa = arena_calloc(arena, 1, sizeof(dfa_t));
+    if(!dfa)
+        goto exit;
+    dfa->num_states = dfa->max_states = hdr.num_states;
+    dfa->num_targets = dfa->max_targets = hdr.num_states;
+    dfa->num_classes = hdr.num_classes;
+    dfa->states = arena_alloc(arena, num_entries*sizeof(uint32_t));
+    dfa->targets = arena_alloc(arena, hdr.num_states*sizeof(void*));
+    targets = arena_alloc(arena, hdr.num_states*sizeof(uint32_t));
+    stored_hosts = arena_alloc(arena, num_funcs*sizeof(uint32_t));
+    if(!dfa->states || !dfa->targets || !targets || !stored_hosts)
+        goto fail;
+
+    if(fread(dfa->classes, 1, sizeof(dfa->classes), fd) != sizeof(dfa->classes) ||
+       fread(dfa->states, sizeof(uint32_t), num_entries, fd) != num_entries ||
+       fread(targets, sizeof(uint32_t), hdr.num_states, fd) != hdr.num_states ||
+       fread(stored_hosts, sizeof(uint32_t), num_funcs, fd) != num_funcs)
+        goto fail;
+
+    for(size_t i = 0; i < num_entries; i++) {
+        if(dfa->states[i] >= hdr.num_states)
+            goto fail;
+    }
+    for(size_t i = 0; i < 256; i++) {
+        if(dfa->classes[i] >= hdr.num_classes)
+            goto fail;
+    }
+    for(size_t i = 0; i < hdr.num_states; i++) {
+        if(targets[i] > num_funcs)
+            goto fail;
+        dfa->targets[i] = targets[i] ? &funcs[targets[i]-1] : NULL;
+    }
+    for(size_t i = 0; i < num_funcs; i++) {
+        if(stored_hosts[i] > num_funcs)
+            goto fail;
+    }
+    if(hosts)
+        memcpy(hosts, stored_hosts, num_funcs*sizeof(uint32_t));
+
+    fclose(fd);
+    return dfa;
+fail:
+    dfa = NULL;
+exit:
+    fclose(fd);
+    return dfa;
+}
+
+bool cache_store(arena_t *arena, const char *dir, cache_key_t *key, dfa_t *dfa, regexp_func_t *funcs, size_t num_funcs, uint32_t *hosts) {
+    FILE *fd = NULL;
+    cache_hdr_t hdr = {0};
+    char *path, *tmp_path = NULL;
+    uint32_t *targets;
+    size_t len;
+
+    if(mkdir(dir, 0777) < 0 && errno != EEXIST) {
+        perror("mkdir");
+        return false;
+    }
+
+    path = cache_path(arena, dir, key);
+    if(!path)
+        return false;
+
+    // concurrent generators must never see a partially written file
+    len = strlen(path) + 24;
+    tmp_path = arena_alloc(arena, len);
+    if(!tmp_path)
+        return false;
+    snprintf(tmp_path, len, "%s.%ld.tmp", path, (long)getpid());
+
+    targets = arena_alloc(arena, dfa->num_states*sizeof(uint32_t));
+    if(!targets)
+        return false;
+    for(size_t i = 0; i < dfa->num_states; i++)
+        targets[i] = dfa->targets[i] ? (regexp_func_t*)dfa->targets[i] - funcs + 1 : 0;
+    // keyword hosts are stored for every rule, zeros without keywords
+    if(!hosts) {
+        hosts = arena_calloc(arena, num_funcs, sizeof(uint32_t));
+        if(!hosts)
+            return false;
+    }
+
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    hdr.num_classes = dfa->num_classes;
+    hdr.key_len = key->key_len;
+    hdr.num_states = dfa->num_states;
+
+    fd = fopen(tmp_path, "wb");
+    if(!fd) {
+        perror("fopen");
+        return false;
+    }
+
+    size_t num_entries = dfa->num_states*dfa->num_classes;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fd) == 1 &&
+              fwrite(key->key, 1, key->key_len, fd) == key->key_len &&
+              fwrite(dfa->classes, 1, sizeof(dfa->classes), fd) == sizeof(dfa->classes) &&
+              fwrite(dfa->states, sizeof(uint32_t), num_entries, fd) == num_entries &&
+              fwrite(targets, sizeof(uint32_t), dfa->num_states, fd) == dfa->num_states &&
+              fwrite(hosts, sizeof(uint32_t), num_funcs, fd) == num_funcs;
+    if(fclose(fd) != 0)
+        ok = false;
+
+    if(!ok || rename(tmp_path, path) < 0) {
+        perror("write cache");
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
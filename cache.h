@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "regexp.h"
+#include "trans.h"
+
+// Built DFAs are stored in the cache directory under the hash of
+// everything they depend on: the regular expressions, their order and
+// the generator options. The key itself is stored too, so a hash
+// collision is a cache miss, not a wrong DFA.
+typedef struct {
+    char     *key;
+    size_t   key_len;
+    uint64_t hash;
+} cache_key_t;
+
+bool cache_make_key(arena_t *arena, regexp_func_t *funcs, size_t num_funcs, const char *options, cache_key_t *key);
+// hosts has a keyword host index+1 or 0 for every rule, it may be NULL
+dfa_t* cache_load(arena_t *arena, const char *dir, cache_key_t *key, regexp_func_t *funcs, size_t num_funcs, uint32_t *hosts);
+bool cache_store(arena_t *arena, const char *dir, cache_key_t *key, dfa_t *dfa, regexp_func_t *funcs, size_t num_funcs, uint32_t *hosts);
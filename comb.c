@@ -0,0 +1,189 @@
+#include "comb.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// states whose rows are tried as a default for the next state
+#define COMB_WINDOW 64
+#define COMB_FREE UINT32_MAX
+
+typedef struct {
+    uint32_t cls;
+    uint32_t val;
+} comb_entry_t;
+
+typedef struct {
+    arena_t    *arena;
+    dfa_comb_t *comb;
+    // skip[i] leads to the first free entry at or after i
+    uint32_t   *skip;
+    size_t     max_entries;
+} comb_build_t;
+
+static bool comb_reserve(comb_build_t *b, size_t num_entries) {
+    dfa_comb_t *comb = b->comb;
+    if(num_entries <= b->max_entries)
+        return true;
+
+    size_t old_max = b->max_entries, new_max = old_max ? old_max : 64;
+    while(new_max < num_entries)
+        new_max <<= 1;
+    uint32_t *next = arena_realloc(b->arena, comb->next, old_max*sizeof(uint32_t), new_max*sizeof(uint32_t));
+    uint32_t *check = arena_realloc(b->arena, comb->check, old_max*sizeof(uint32_t), new_max*sizeof(uint32_t));
+    uint32_t *skip = arena_realloc(b->arena, b->skip, old_max*sizeof(uint32_t), new_max*sizeof(uint32_t));
+    if(!next || !check || !skip)
+        return false;
+    memset(next + old_max, 0, (new_max - old_max)*sizeof(uint32_t));
+    memset(check + old_max, 0xff, (new_max - old_max)*sizeof(uint32_t));
+    for(size_t i = old_max; i < new_max; i++)
+        skip[i] = i;
+    comb->next = next;
+    comb->check = check;
+    b->skip = skip;
+    b->max_entries = new_max;
+    return true;
+}
+
+static size_t comb_next_free(comb_build_t *b, size_t i) {
+    if(!comb_reserve(b, i+1))
+        return SIZE_MAX;
+    size_t root = i;
+    while(b->skip[root] != root) {
+        root = b->skip[root];
+        if(!comb_reserve(b, root+1))
+            return SIZE_MAX;
+    }
+    while(b->skip[i] != root) {
+        size_t tmp = b->skip[i];
+        b->skip[i] = root;
+        i = tmp;
+    }
+    return root;
+}
+
+// rows which differ from a recent state in fewer entries than they have
+// transitions get it as a default, then rows are packed into one vector
+// by first fit, the biggest rows first. Hot states get no default, so they
+// take one lookup, and are packed before the others.
+dfa_comb_t* dfa_comb(arena_t *arena, dfa_t *dfa, const bool *hot) {
+    size_t n = dfa->num_states, k = dfa->num_classes;
+    size_t window[COMB_WINDOW], num_window = 0;
+    comb_build_t b = { arena, NULL, NULL, 0 };
+    dfa_comb_t *comb;
+
+    comb = arena_calloc(arena, 1, sizeof(dfa_comb_t));
+    if(!comb)
+        return NULL;
+    comb->num_states = n;
+    comb->base = arena_calloc(arena, n, sizeof(uint32_t));
+    comb->deflt = arena_calloc(arena, n, sizeof(uint32_t));
+    b.comb = comb;
+    if(!comb->base || !comb->deflt || !comb_reserve(&b, k))
+        return NULL;
+    comb->num_entries = k;
+
+    // scratch memory lives until the end of packing only
+    arena_t *tmp = arena_create(1 << 16);
+    if(!tmp)
+        return NULL;
+    comb_entry_t **entries = arena_alloc(tmp, n*sizeof(comb_entry_t*));
+    size_t *num_entries = arena_alloc(tmp, n*sizeof(size_t));
+    size_t *order = arena_alloc(tmp, n*sizeof(size_t));
+    size_t *by_len = arena_calloc(tmp, k+2, sizeof(size_t));
+    if(!entries || !num_entries || !order || !by_len)
+        goto fail;
+
+    for(size_t s = 0; s < n; s++) {
+        uint32_t *row = dfa->states + s*k, *def = NULL;
+        size_t nz = 0, best = 0, best_diff;
+
+        for(size_t c = 0; c < k; c++)
+            nz += row[c] != 0;
+        best_diff = nz;
+        for(size_t w = 0; w < num_window && !(hot && hot[s]); w++) {
+            uint32_t *trow = dfa->states + window[w]*k;
+            size_t diff = 0;
+            for(size_t c = 0; c < k && diff < best_diff; c++)
+                diff += row[c] != trow[c];
+            if(diff < best_diff) {
+                best_diff = diff;
+                best = window[w];
+            }
+        }
+
+        if(best) {
+            comb->deflt[s] = best;
+            def = dfa->states + best*k;
+        } else if(s != 0) {
+            window[num_window < COMB_WINDOW ? num_window++ : s % COMB_WINDOW] = s;
+        }
+
+        entries[s] = arena_alloc(tmp, best_diff*sizeof(comb_entry_t) + 1);
+        if(!entries[s])
+            goto fail;
+        num_entries[s] = 0;
+        for(size_t c = 0; c < k; c++) {
+            if(row[c] != (def ? def[c] : 0))
+                entries[s][num_entries[s]++] = (comb_entry_t){ c, row[c] };
+        }
+        by_len[k - num_entries[s] + 1]++;
+    }
+
+    size_t num_hot = 0;
+    for(size_t s = 0; s < n && hot; s++) {
+        if(hot[s]) {
+            order[num_hot++] = s;
+            by_len[k - num_entries[s] + 1]--;
+        }
+    }
+    by_len[0] = num_hot;
+    for(size_t i = 1; i <= k+1; i++)
+        by_len[i] += by_len[i-1];
+    for(size_t s = 0; s < n; s++) {
+        if(!hot || !hot[s])
+            order[by_len[k - num_entries[s]]++] = s;
+    }
+
+    // only bases which put the first entry into a free slot are tried
+    for(size_t i = 0; i < n; i++) {
+        size_t s = order[i], num = num_entries[s], base, slot = 0;
+        comb_entry_t *e = entries[s];
+        if(num == 0)
+            continue;
+
+        for(;;) {
+            slot = comb_next_free(&b, slot > e[0].cls ? slot : e[0].cls);
+            if(slot == SIZE_MAX)
+                goto fail;
+            base = slot - e[0].cls;
+            if(!comb_reserve(&b, base+k))
+                goto fail;
+            size_t j;
+            for(j = 1; j < num && comb->check[base + e[j].cls] == COMB_FREE; j++)
+                ;
+            if(j == num)
+                break;
+            slot++;
+        }
+
+        comb->base[s] = base;
+        for(size_t j = 0; j < num; j++) {
+            comb->check[base + e[j].cls] = s;
+            comb->next[base + e[j].cls] = e[j].val;
+            b.skip[base + e[j].cls] = base + e[j].cls + 1;
+        }
+        if(base+k > comb->num_entries)
+            comb->num_entries = base+k;
+    }
+
+    for(size_t i = 0; i < comb->num_entries; i++) {
+        if(comb->check[i] == COMB_FREE)
+            comb->check[i] = n;
+    }
+
+    arena_free(tmp);
+    return comb;
+fail:
+    arena_free(tmp);
+    return NULL;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "regexp.h"
+
+// Comb-vector form of a DFA transition table. Row of state s is looked up
+// at base[s]: next[base[s]+cls] is the transition if check[base[s]+cls] is
+// s, otherwise the row of state deflt[s] is tried and 0 means there is no
+// transition. The start state is never a default, so deflt[s] = 0 means
+// s has no default. Default states have no default themselves.
+typedef struct {
+    uint32_t *base;
+    uint32_t *deflt;
+    uint32_t *next;
+    uint32_t *check;
+    size_t   num_states;
+    size_t   num_entries;
+} dfa_comb_t;
+
+// hot is NULL or marks states which must not have a default
+dfa_comb_t* dfa_comb(arena_t *arena, dfa_t *dfa, const bool *hot);
@@ -0,0 +1,49 @@
+#include "dfa_file.h"
+
+#include <string.h>
+
+#define ALIGN_UP(x) (((x) + DFA_FILE_ALIGN-1) & ~(uint64_t)(DFA_FILE_ALIGN-1))
+
+static bool write_padding(FILE *fd, uint64_t from, uint64_t to) {
+    static const char zeros[DFA_FILE_ALIGN];
+    return fwrite(zeros, 1, to - from, fd) == to - from;
+}
+
+bool dfa_file_gen(FILE *fd, dfa_t *dfa, regexp_func_t *funcs, size_t num_funcs) {
+    size_t num_entries = dfa->num_states*dfa->num_classes;
+    dfa_file_hdr_t hdr = { .version = DFA_FILE_VERSION, .byte_order = DFA_FILE_ORDER };
+    uint64_t classes_end, states_end;
+
+    memcpy(hdr.magic, DFA_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.num_states = dfa->num_states;
+    hdr.num_classes = dfa->num_classes;
+    hdr.num_rules = num_funcs;
+    hdr.classes_off = ALIGN_UP(sizeof(hdr));
+    classes_end = hdr.classes_off + sizeof(dfa->classes);
+    hdr.states_off = ALIGN_UP(classes_end);
+    states_end = hdr.states_off + num_entries*sizeof(uint16_t);
+    hdr.targets_off = ALIGN_UP(states_end);
+    hdr.size = hdr.targets_off + dfa->num_states*sizeof(uint32_t);
+    // transitions are stored as uint16_t
+    if(hdr.size > UINT32_MAX || dfa->num_states > UINT16_MAX+1) {
+        fputs("DFA is too big for the binary format\n", stderr);
+        return false;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fd) == 1 &&
+              write_padding(fd, sizeof(hdr), hdr.classes_off) &&
+              fwrite(dfa->classes, 1, sizeof(dfa->classes), fd) == sizeof(dfa->classes) &&
+              write_padding(fd, classes_end, hdr.states_off);
+    for(size_t i = 0; i < num_entries && ok; i++) {
+        uint16_t next = dfa->states[i];
+        ok = fwrite(&next, sizeof(next), 1, fd) == 1;
+    }
+    ok = ok && write_padding(fd, states_end, hdr.targets_off);
+    for(size_t i = 0; i < dfa->num_states && ok; i++) {
+        uint32_t rule = dfa->targets[i] ? (regexp_func_t*)dfa->targets[i] - funcs + 1 : 0;
+        ok = fwrite(&rule, sizeof(rule), 1, fd) == 1;
+    }
+    if(!ok)
+        perror("write");
+    return ok;
+}
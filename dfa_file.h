@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "regexp.h"
+#include "trans.h"
+
+#define DFA_FILE_MAGIC "TRANSDFA"
+#define DFA_FILE_VERSION 1
+#define DFA_FILE_ORDER 0x01020304
+#define DFA_FILE_ALIGN 64
+
+// DFA of the mmap engine, which lexer_c_mmap maps read-only. Every section
+// starts at a multiple of DFA_FILE_ALIGN, so tables are used in place:
+// 256 byte classes, num_states*num_classes uint16_t transitions and
+// num_states uint32_t targets, rule index+1 or 0 if a state accepts nothing.
+// byte_order is DFA_FILE_ORDER as written by the host which made the file.
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_states;
+    uint32_t num_classes;
+    uint32_t num_rules;
+    uint32_t classes_off;
+    uint32_t states_off;
+    uint32_t targets_off;
+    uint64_t size;
+} dfa_file_hdr_t;
+
+bool dfa_file_gen(FILE *fd, dfa_t *dfa, regexp_func_t *funcs, size_t num_funcs);
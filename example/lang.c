@@ -1,31 +1,71 @@
 #include "lang.h"
 
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static inline int parse_int(const char *str) {
-    return atoi(str);
+
+// lexer which runs actions in this thread
+static _Thread_local lexer_t *lexer_cur;
+
+// lexemes point into the input and aren't terminated by zero, lexer_str
+// returns a terminated copy for actions which need one. It's valid until
+// the next call of lexer_str.
+static inline char* lexer_str(lexeme_t *m) {
+    lexer_t *lex = lexer_cur;
+    if(m->str_len + 1 > lex->max_str) {
+        size_t max = lex->max_str ? lex->max_str : 32;
+        while(m->str_len + 1 > max)
+            max <<= 1;
+        char *tmp = realloc(lex->str, max);
+        if(!tmp) {
+            perror("realloc");
+            return NULL;
+        }
+        lex->str = tmp;
+        lex->max_str = max;
+    }
+    memcpy(lex->str, m->str, m->str_len);
+    lex->str[m->str_len] = 0;
+    return lex->str;
+}
+static inline int parse_int(const char *str, size_t len) {
+    int res = 0;
+    for(size_t i = 0; i < len; i++)
+        res = res*10 + str[i] - '0';
+    return res;
 }
 
 static float parse_float(const char *str) {
     return atof(str);
 }
 
-static int f0(lexeme_t *lex) { 
+static int f0_rule(lexeme_t *lex) { 
     char *tmp = malloc(lex->str_len+1);
     if(!tmp) {
         perror("malloc");
         return -1;
     }
-    memcpy(tmp, lex->str, lex->str_len+1);
+    memcpy(tmp, lex->str, lex->str_len);
+    tmp[lex->str_len] = 0;
     lex->str = tmp;
     return ID;
 }
-static int f1(lexeme_t *lex) { lex->num.tag = INT; lex->num.i = parse_int(lex->str); return NUM; }
-static int f2(lexeme_t *lex) { lex->num.tag = FLOAT; lex->num.f = parse_float(lex->str); return NUM; }
+static int f1(lexeme_t *lex) { lex->num.tag = INT; lex->num.i = parse_int(lex->str, lex->str_len); return NUM; }
+static int f2(lexeme_t *lex) {
+    char *str = lexer_str(lex);
+    if(!str)
+        return -1;
+    lex->num.tag = FLOAT;
+    lex->num.f = parse_float(str);
+    return NUM;
+}
 static int f3(lexeme_t *lex) { return IF; }
 static int f4(lexeme_t *lex) { return THEN; }
 static int f5(lexeme_t *lex) { return ELSE; }
@@ -37,150 +77,1019 @@ static int f10(lexeme_t *lex) { lex->relop.op = LT; return RELOP; }
 static int f11(lexeme_t *lex) { lex->relop.op = GT; return RELOP; }
 static int f12(lexeme_t *lex) { return NONE; }
 
-static unsigned char states[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 4, 5, 6, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 8, 7, 7, 7, 9, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 10, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 11, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 12, 0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 13, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 14, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 16, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 17, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 18, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 20, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 21, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 22, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 23, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+typedef int (*lexer_action_t)(lexeme_t*);
 
-static int (*targets[])(lexeme_t*) = { NULL, f12, NULL, f1, f10, NULL, f11, f0, f0, f0, f0, f7, NULL, f8, f6, f9, f0, f3, f0, f2, f0, f0, f5, f4 };
+// same hash as the generator uses for keyword tables
+static inline unsigned int lexer_kw_hash(const char *str, size_t len, unsigned int seed) {
+    unsigned int hash = 0x811c9dc5 ^ seed;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 0x01000193;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
 
-lexer_t* lexer_create(const char *filename) {
-    lexer_t *lex;
-    int fd = -1;
+static const char *const kw0_str[] = { "if", "then", "else" };
+static const size_t kw0_len[] = { 2, 4, 4 };
+static const lexer_action_t kw0_func[] = { f3, f4, f5 };
+static const unsigned int kw0_disp[] = { 1, 0, 3 };
 
-    lex = malloc(sizeof(lexer_t));
-    if(!lex) {
-        perror("malloc");
-        goto exit;
+static int f0(lexeme_t *lex) {
+    size_t slot = lexer_kw_hash(lex->str, lex->str_len, 0) % 3;
+    slot = lexer_kw_hash(lex->str, lex->str_len, kw0_disp[slot]) % 3;
+    if(kw0_len[slot] == lex->str_len && !memcmp(kw0_str[slot], lex->str, lex->str_len))
+        return kw0_func[slot](lex);
+    return f0_rule(lex);
+}
+
+#define LEXER_NUM_CLASSES 9
+
+static unsigned char classes[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 5, 6, 7, 0, 0, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+static const unsigned char states[] = { 0, 1, 2, 0, 3, 4, 5, 6, 7, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 0, 0, 0, 0, 0, 9, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 11, 0, 0, 0, 0, 0, 0, 0, 0, 12, 0, 0, 0, 0, 0, 0, 7, 0, 0, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 13, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 13, 0, 0, 0, 0 };
+
+static lexer_action_t targets[] = { NULL, f12, NULL, f1, f10, NULL, f11, f0, f7, NULL, f8, f6, f9, f2 };
+
+
+#ifdef LEXER_PROFILE
+#define LEXER_NUM_STATES 14
+#define LEXER_PROF_HASH "9ade55e23432ac19"
+#define LEXER_PROF_ID(s) (s)
+#endif
+
+#ifdef LEXER_PROFILE
+#ifndef LEXER_PROFILE_FILE
+#define LEXER_PROFILE_FILE "lexer.prof"
+#endif
+
+// counts of all lexers of the process, lexer_free writes them for trans -P
+static unsigned long long prof_visits[LEXER_NUM_STATES];
+static unsigned long long prof_edges[LEXER_NUM_STATES][LEXER_NUM_CLASSES];
+
+// lexers of lexer_lex_parallel set prof_off, they would race on the
+// counts and count chunks lexed again twice
+#define LEXER_PROF_STEP(state, c) (lex->prof_off ? 0 : (prof_visits[state]++, prof_edges[state][classes[c]]++))
+
+static void lexer_prof_write(void) {
+    FILE *fd = fopen(LEXER_PROFILE_FILE, "w");
+    if(!fd) {
+        perror(LEXER_PROFILE_FILE);
+        return;
+    }
+    fprintf(fd, "trans profile %d %d %s\n", LEXER_NUM_STATES, LEXER_NUM_CLASSES, LEXER_PROF_HASH);
+    for(int s = 0; s < LEXER_NUM_STATES; s++) {
+        if(!prof_visits[s])
+            continue;
+        fprintf(fd, "state %u %llu\n", LEXER_PROF_ID(s), prof_visits[s]);
+        for(int c = 0; c < LEXER_NUM_CLASSES; c++) {
+            if(prof_edges[s][c])
+                fprintf(fd, "edge %u %d %llu\n", LEXER_PROF_ID(s), c, prof_edges[s][c]);
+        }
     }
-    lex->symtab = NULL;
+    fclose(fd);
+}
+#else
+#define LEXER_PROF_STEP(state, c)
+#endif
 
-    fd = open(filename, O_RDONLY);
-    if(fd < 0) {
-        perror("open");
-        goto exit;
+#define LEXER_LOOP_RANGES 4
+
+// bytes which keep a DFA state in itself, lo[i] <= c <= lo[i]+span[i].
+// Unused ranges repeat the first one.
+typedef struct {
+    unsigned char lo[LEXER_LOOP_RANGES], span[LEXER_LOOP_RANGES];
+} lexer_loop_t;
+
+static inline int lexer_loop_has(const lexer_loop_t *l, unsigned char c) {
+    for(int i = 0; i < LEXER_LOOP_RANGES; i++) {
+        if((unsigned char)(c - l->lo[i]) <= l->span[i])
+            return 1;
+    }
+    return 0;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(LEXER_NO_SIMD)
+#include <immintrin.h>
+
+// c is in a range if min(c-lo, span) == c-lo as unsigned bytes
+__attribute__((target("sse2")))
+static inline size_t lexer_skip_sse2(const lexer_loop_t *l, const unsigned char *buf, size_t off, size_t len) {
+    __m128i lo[LEXER_LOOP_RANGES], span[LEXER_LOOP_RANGES];
+    for(int i = 0; i < LEXER_LOOP_RANGES; i++) {
+        lo[i] = _mm_set1_epi8(l->lo[i]);
+        span[i] = _mm_set1_epi8(l->span[i]);
+    }
+    for(; off + 16 <= len; off += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buf + off)), in = _mm_setzero_si128();
+        for(int i = 0; i < LEXER_LOOP_RANGES; i++) {
+            __m128i d = _mm_sub_epi8(v, lo[i]);
+            in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(d, span[i]), d));
+        }
+        unsigned int out = ~_mm_movemask_epi8(in) & 0xffff;
+        if(out)
+            return off + __builtin_ctz(out);
+    }
+    return off;
+}
+
+__attribute__((target("avx2")))
+static inline size_t lexer_skip_avx2(const lexer_loop_t *l, const unsigned char *buf, size_t off, size_t len) {
+    __m256i lo[LEXER_LOOP_RANGES], span[LEXER_LOOP_RANGES];
+    for(int i = 0; i < LEXER_LOOP_RANGES; i++) {
+        lo[i] = _mm256_set1_epi8(l->lo[i]);
+        span[i] = _mm256_set1_epi8(l->span[i]);
+    }
+    for(; off + 32 <= len; off += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buf + off)), in = _mm256_setzero_si256();
+        for(int i = 0; i < LEXER_LOOP_RANGES; i++) {
+            __m256i d = _mm256_sub_epi8(v, lo[i]);
+            in = _mm256_or_si256(in, _mm256_cmpeq_epi8(_mm256_min_epu8(d, span[i]), d));
+        }
+        unsigned int out = ~(unsigned int)_mm256_movemask_epi8(in);
+        if(out)
+            return off + __builtin_ctz(out);
+    }
+    return off;
+}
+
+// skips the bytes of a loop from off, 32 or 16 at a time while they fit
+static inline size_t lexer_skip(const lexer_loop_t *l, const unsigned char *buf, size_t off, size_t len) {
+    if(__builtin_cpu_supports("avx2"))
+        off = lexer_skip_avx2(l, buf, off, len);
+    else
+        off = lexer_skip_sse2(l, buf, off, len);
+    while(off < len && lexer_loop_has(l, buf[off]))
+        off++;
+    return off;
+}
+#else
+static inline size_t lexer_skip(const lexer_loop_t *l, const unsigned char *buf, size_t off, size_t len) {
+    while(off < len && lexer_loop_has(l, buf[off]))
+        off++;
+    return off;
+}
+#endif
+
+// a profiling build counts every byte, so loops aren't skipped
+#ifdef LEXER_PROFILE
+#define LEXER_SKIP(l, buf, off, len) ((void)(l), (off))
+#else
+#define LEXER_SKIP(l, buf, off, len) lexer_skip(l, buf, off, len)
+#endif
+
+static const lexer_loop_t lexer_loops[] = {
+    { { 9, 32, 9, 9 }, { 1, 0, 1, 1 } },
+    { { 48, 48, 48, 48 }, { 9, 9, 9, 9 } },
+    { { 48, 65, 97, 48 }, { 9, 25, 25, 9 } },
+    { { 48, 48, 48, 48 }, { 9, 9, 9, 9 } },
+};
+
+#define LEXER_LOOPS
+static const unsigned char loop_ids[] = { 0, 1, 0, 2, 0, 0, 0, 3, 0, 0, 0, 0, 0, 4 };
+static inline int lexer_engine_init(lexer_t *lex) {
+    return 0;
+}
+
+static inline void lexer_engine_free(lexer_t *lex) {
+#ifdef LEXER_PROFILE
+    if(!lex->prof_off)
+        lexer_prof_write();
+#endif
+}
+
+static inline int lexer_step(lexer_t *lex, int state, unsigned char c) {
+    LEXER_PROF_STEP(state, c);
+    return states[state*LEXER_NUM_CLASSES + classes[c]];
+}
+
+static inline lexer_action_t lexer_target(lexer_t *lex, int state) {
+    return targets[state];
+}
+
+
+// runs the automaton over buf[off..len) from *state and returns where it
+// stopped: len or the first byte without a transition. The last accepting
+// position and its target are stored in *targ_off and *target.
+static inline size_t lexer_scan(lexer_t *lex, int *state, const unsigned char *buf, size_t off, size_t len, lexer_action_t *target, size_t *targ_off) {
+    int cur = *state, next;
+    lexer_action_t t;
+
+    while(off < len) {
+        next = lexer_step(lex, cur, buf[off]);
+        if(next == 0)
+            break;
+        off++;
+#ifdef LEXER_LOOPS
+        // a taken self loop skips the rest of its bytes at once
+        if(next == cur && loop_ids[cur])
+            off = LEXER_SKIP(&lexer_loops[loop_ids[cur]-1], buf, off, len);
+#endif
+        cur = next;
+        if((t = lexer_target(lex, cur))) {
+            *target = t;
+            *targ_off = off;
+        }
     }
-    lex->fd = fd;
+    *state = cur;
+    return off;
+}
+#define LEXER_HALF (sizeof(((lexer_t*)0)->buf)/2)
 
+static lexer_t* lexer_alloc(void) {
+    lexer_t *lex = malloc(sizeof(lexer_t));
+    if(!lex) {
+        perror("malloc");
+        return NULL;
+    }
+    lex->fd = -1;
+    lex->data = NULL;
+    lex->mapped = 0;
     lex->cur_buf = 1;
+    lex->buf_len[0] = lex->buf_len[1] = 0;
+    lex->buf_pos[0] = lex->buf_pos[1] = 0;
+    lex->ahead = 0;
+    lex->replay = NULL;
+    lex->replay_len = lex->replay_off = lex->max_replay = 0;
+    lex->failed = 0;
+    lex->quiet = 0;
+    lex->prof_off = 0;
     lex->buf_off = 0;
-    lex->read_len = 0;
-    lex->cur_line = 1;
-    lex->cur_chr = 1;
+    lex->lines = NULL;
+    lex->num_lines = lex->max_lines = 0;
+    lex->lines_off = 0;
+    lex->push_start = 0;
+    lex->push_state = 0;
+    lex->push_target = NULL;
+    lex->push_targ_len = 0;
+    lex->push_toks = NULL;
+    lex->max_push_toks = 0;
+    lex->str = NULL;
+    lex->max_str = 0;
 
     lex->max_bytes = 32;
     lex->num_bytes = 0;
     lex->symtab = malloc(lex->max_bytes);
     if(!lex->symtab) {
         perror("malloc");
-        goto exit;
+        free(lex);
+        return NULL;
+    }
+    if(lexer_engine_init(lex) < 0) {
+        lexer_engine_free(lex);
+        free(lex->symtab);
+        free(lex);
+        return NULL;
+    }
+    return lex;
+}
+
+// a regular file is mapped whole when map is set, other files and
+// pipes are read into buf
+static lexer_t* lexer_open(const char *filename, int map) {
+    struct stat st;
+    lexer_t *lex = lexer_alloc();
+    if(!lex)
+        return NULL;
+
+    lex->fd = open(filename, O_RDONLY);
+    if(lex->fd < 0) {
+        perror("open");
+        lexer_free(lex);
+        return NULL;
     }
 
+    if(map && fstat(lex->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, lex->fd, 0);
+        if(data != MAP_FAILED) {
+            // hints are declared by glibc with _DEFAULT_SOURCE only
+#ifdef MADV_SEQUENTIAL
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_HUGEPAGE
+            madvise(data, st.st_size, MADV_HUGEPAGE);
+#endif
+            lex->data = data;
+            lex->data_len = st.st_size;
+            lex->mapped = 1;
+            close(lex->fd);
+            lex->fd = -1;
+        }
+    }
     return lex;
-exit:
-    if(lex) {
-        if(lex->symtab) free(lex->symtab);
-        free(lex);
+}
+
+lexer_t* lexer_create(const char *filename) {
+    return lexer_open(filename, 0);
+}
+
+lexer_t* lexer_create_mmap(const char *filename) {
+    return lexer_open(filename, 1);
+}
+
+// lexemes point into data, which must outlive the lexer
+lexer_t* lexer_create_buffer(const char *data, size_t len) {
+    lexer_t *lex = lexer_alloc();
+    if(!lex)
+        return NULL;
+    lex->data = len ? data : "";
+    lex->data_len = len;
+    return lex;
+}
+
+// lines holds offsets after the newlines of input read so far, it's
+// built by memchr over each read buffer or fed piece, over mapped files
+// and buffers only when a position is asked for
+static int lexer_index(lexer_t *lex, const char *buf, size_t len) {
+#ifndef LEXER_NO_POS
+    const char *cur = buf, *end = buf + len, *nl;
+    while((nl = memchr(cur, '\n', end - cur))) {
+        if(lex->num_lines == lex->max_lines) {
+            size_t new_max = lex->max_lines ? lex->max_lines << 1 : 256;
+            size_t *tmp = realloc(lex->lines, new_max*sizeof(size_t));
+            if(!tmp) {
+                perror("realloc");
+                return 0;
+            }
+            lex->lines = tmp;
+            lex->max_lines = new_max;
+        }
+        lex->lines[lex->num_lines++] = lex->lines_off + (nl + 1 - buf);
+        cur = nl + 1;
     }
-    if(fd >= 0) close(fd);
-    return NULL;
+#else
+    (void)buf;
+#endif
+    lex->lines_off += len;
+    return 1;
 }
 
-lexer_res_t lexer_next_tok(lexer_t *lex, lexeme_t *m) {
-    int cur_state = 0, next_state = -1;
-    int (*target)(lexeme_t*) = NULL;
-    int (*next_target)(lexeme_t*) = NULL;
-    size_t lexeme_len = 0;
-    size_t targ_off, targ_line, targ_chr;
-    int targ_buf;
-    char *buf = lex->buf + (lex->cur_buf*sizeof(lex->buf)/2);
-    unsigned char c = 0;
-    ssize_t read_len = 0;
+// line and column of the byte at offset off from the start of input.
+// With LEXER_NO_POS input is counted as one line.
+void lexer_pos(lexer_t *lex, size_t off, size_t *line, size_t *col) {
+    if(lex->data && off > lex->lines_off) {
+        size_t end = off < lex->data_len ? off : lex->data_len;
+        lexer_index(lex, lex->data + lex->lines_off, end - lex->lines_off);
+    }
+    size_t lo = 0, hi = lex->num_lines;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if(lex->lines[mid] <= off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *line = lo + 1;
+    *col = off - (lo ? lex->lines[lo-1] : 0) + 1;
+}
+
+static void lexer_error(lexer_t *lex, size_t off, char c) {
+    size_t line, col;
+    if(lex->quiet)
+        return;
+    lexer_pos(lex, off, &line, &col);
+    fprintf(stderr, "%lu:%lu unexpected %c\n", line, col, c);
+}
+
+// moves to the other half of buf, it's read only if it doesn't already
+// hold the data following the current half
+static int lexer_refill(lexer_t *lex) {
+    int next = !lex->cur_buf;
+    if(!lex->ahead) {
+        ssize_t len = read(lex->fd, lex->buf + next*LEXER_HALF, LEXER_HALF);
+        if(len < 0) {
+            perror("read");
+            return -1;
+        }
+        lex->buf_len[next] = len;
+        lex->buf_pos[next] = lex->buf_pos[lex->cur_buf] + lex->buf_len[lex->cur_buf];
+        if(!lexer_index(lex, lex->buf + next*LEXER_HALF, len))
+            return -1;
+    }
+    lex->ahead = 0;
+    lex->cur_buf = next;
+    lex->buf_off = 0;
+    return 0;
+}
+
+// bytes after the lexeme in symtab are scanned again from replay, when
+// the half which held them was read over
+static int lexer_replay(lexer_t *lex, size_t targ_len) {
+    size_t n = lex->num_bytes - targ_len;
+    if(n > lex->max_replay) {
+        size_t new_max = lex->max_replay ? lex->max_replay : 256;
+        while(n > new_max)
+            new_max <<= 1;
+        char *tmp = realloc(lex->replay, new_max);
+        if(!tmp) {
+            perror("realloc");
+            return 0;
+        }
+        lex->replay = tmp;
+        lex->max_replay = new_max;
+    }
+    memcpy(lex->replay, lex->symtab + targ_len, n);
+    lex->replay_len = n;
+    lex->replay_off = 0;
+    return 1;
+}
+
+// offset from the start of input of byte off of replay, while it's
+// scanned, or of the current half
+static inline size_t lexer_offset(lexer_t *lex, size_t off) {
+    if(lex->replay_len)
+        return lex->buf_pos[lex->cur_buf] + lex->buf_off - lex->replay_len + off;
+    return lex->buf_pos[lex->cur_buf] + off;
+}
+
+// appends bytes of a lexeme which continues past the end of a run
+static inline int lexer_spill(lexer_t *lex, const char *str, size_t len) {
+    if(lex->num_bytes + len > lex->max_bytes) {
+        while(lex->num_bytes + len > lex->max_bytes)
+            lex->max_bytes <<= 1;
+        char *tmp = realloc(lex->symtab, lex->max_bytes);
+        if(!tmp) {
+            perror("realloc");
+            return 0;
+        }
+        lex->symtab = tmp;
+    }
+    memcpy(lex->symtab + lex->num_bytes, str, len);
+    return 1;
+}
+
+// next lexeme and its offset from the start of input, lexer_cur must be set
+static inline lexer_res_t lexer_tok(lexer_t *lex, lexeme_t *m, size_t *pos) {
+    int cur_state = 0;
+    lexer_action_t target = NULL;
+    size_t targ_len = 0, targ_off = 0, tok_start, start, len, off;
+    int targ_buf = 0, targ_replay, refills, spilled;
+    const char *buf, *str;
 
     for(;;) {
-        for(size_t i = lex->buf_off; i < lex->read_len; i++) {
-            c = buf[i];
+        // the automaton runs over whole buffers or the whole mapped file.
+        // Lexemes point into them, bytes are copied to symtab only when a
+        // lexeme continues into the other half of buf.
+        tok_start = lex->buf_off;
+        *pos = lex->buf_pos[lex->cur_buf] + tok_start;
+        spilled = targ_replay = refills = 0;
 
-            if(next_target) {
-                target = next_target;
-                targ_buf = lex->cur_buf;
-                targ_off = i;
-                targ_line = lex->cur_line;
-                targ_chr = lex->cur_chr;
-                next_target = NULL;
-            }
+        // the first run of a lexeme may be over replay
+        if(lex->replay_len) {
+            buf = lex->replay;
+            len = lex->replay_len;
+            start = tok_start = lex->replay_off;
+            *pos = lexer_offset(lex, start);
+            lexer_action_t run_target = NULL;
+            size_t run_off = 0;
 
-            next_state = states[cur_state*255 + c];
+            off = lexer_scan(lex, &cur_state, (const unsigned char*)buf, start, len, &run_target, &run_off);
 
-            if(lex->num_bytes == lex->max_bytes) {
-                lex->max_bytes <<= 1;
-                char *tmp = realloc(lex->symtab, lex->max_bytes);
-                if(!tmp) {
-                    perror("realloc");
+            if(off == len) {
+                if(!lexer_spill(lex, buf + start, off-start))
                     return LEX_ERROR;
-                }
-                lex->symtab = tmp;
+                spilled = 1;
+            }
+            if(run_target) {
+                target = run_target;
+                targ_replay = 1;
+                targ_off = run_off;
+                targ_len = run_off-start;
+            }
+            lex->num_bytes += off-start;
+            lex->replay_off = off;
+            // the half goes on after replay
+            if(off == len)
+                lex->replay_len = 0;
+        }
+
+        while(!lex->replay_len) {
+            if(lex->data) {
+                buf = lex->data;
+                len = lex->data_len;
+            } else {
+                buf = lex->buf + lex->cur_buf*LEXER_HALF;
+                len = lex->buf_len[lex->cur_buf];
             }
-            lex->symtab[lex->num_bytes++] = next_state == 0 ? 0 : c;
+            start = lex->buf_off;
+            lexer_action_t run_target = NULL;
+            size_t run_off = 0;
 
-            if(next_state == 0)
-                break;
-            next_target = targets[next_state];
+            off = lexer_scan(lex, &cur_state, (const unsigned char*)buf, start, len, &run_target, &run_off);
 
-            cur_state = next_state;
-            if(c == '\n') {
-                lex->cur_line++;
-                lex->cur_chr = 0;
+            if(spilled || (off == len && !lex->data)) {
+                if(!lexer_spill(lex, buf + start, off-start))
+                    return LEX_ERROR;
+                spilled = 1;
+            }
+
+            if(run_target) {
+                target = run_target;
+                targ_buf = lex->cur_buf;
+                targ_replay = 0;
+                targ_off = run_off;
+                targ_len = lex->num_bytes + (run_off-start);
+                refills = 0;
             }
-            lex->cur_chr++;
-            lex->buf_off++;
-            lexeme_len++;
+            lex->num_bytes += off-start;
+            lex->buf_off = off;
+
+            if(off < len || lex->data)
+                break;
+            if(lexer_refill(lex) < 0)
+                return LEX_ERROR;
+            refills++;
+            if(lex->buf_len[lex->cur_buf] == 0)
+                break;
         }
 
-        if(lex->buf_off == lex->read_len) {
-            lex->cur_buf = !lex->cur_buf;
-            buf = lex->buf + (lex->cur_buf*sizeof(lex->buf)/2);
-            read_len = read(lex->fd, buf, sizeof(lex->buf)/2);
-            if(read_len < 0) {
-                perror("read");
+        // a lexeme which wasn't copied lies in the last run
+        str = spilled ? lex->symtab : buf + tok_start;
+
+        // dead state or end of file
+        if(!target) {
+            if(off < len) {
+                lexer_error(lex, lexer_offset(lex, off), buf[off]);
                 return LEX_ERROR;
             }
-            lex->read_len = read_len;
-            lex->buf_off=0;
+            return LEX_EOF;
         }
 
-        if(next_state == 0 || lex->read_len == 0) {
-            if(target) {
-                lex->num_bytes = 0;
-                m->str = lex->symtab;
-                m->str_len = lexeme_len-1;
-                int class = target(m);
-                if(class < 0) {
-                    return LEX_ERROR;
-                } else if(class == 0) {
-                    cur_state = 0;
-                    if(lex->read_len == 0)
-                        return LEX_EOF;
-                } else {
-                    m->class = class;
-                    lex->cur_buf = targ_buf;
-                    lex->buf_off = targ_off;
-                    lex->cur_line = targ_line;
-                    lex->cur_chr = targ_chr;
-                    return LEX_SUCCESS;
-                }
-                target = NULL;
-            } else if(next_state == 0) {
-                fprintf(stderr, "%lu:%lu unexpected %c\n", lex->cur_line, lex->cur_chr, c);
+        // bytes after the lexeme are scanned again from the halves, or
+        // from replay if the half with the end of the lexeme was read over
+        if(targ_replay || refills > 1) {
+            if(lex->replay_len)
+                lex->replay_off = targ_off;
+            else if(!lexer_replay(lex, targ_len))
                 return LEX_ERROR;
-            } else {
-                return LEX_EOF;
+        } else {
+            if(targ_buf != lex->cur_buf) {
+                lex->cur_buf = targ_buf;
+                lex->ahead = 1;
             }
+            lex->buf_off = targ_off;
         }
+
+        m->str = (char*)str;
+        m->str_len = targ_len;
+        int class = target(m);
+        if(class < 0)
+            return LEX_ERROR;
+
+        lex->num_bytes = 0;
+        if(class > 0) {
+            m->class = class;
+            return LEX_SUCCESS;
+        }
+
+        cur_state = 0;
+        target = NULL;
     }
 
     return LEX_ERROR;
 }
 
+lexer_res_t lexer_next_tok(lexer_t *lex, lexeme_t *m) {
+    size_t pos;
+    lexer_cur = lex;
+    return lexer_tok(lex, m, &pos);
+}
+
+// lexer_tok is inlined into the loops of batches. An error is returned
+// after the lexemes which precede it, by the next call.
+ptrdiff_t lexer_next_toks(lexer_t *lex, lexeme_t *out, size_t cap) {
+    size_t n = 0, pos;
+    if(lex->failed)
+        return -1;
+    lexer_cur = lex;
+    while(n < cap) {
+        lexer_res_t res = lexer_tok(lex, out + n, &pos);
+        if(res == LEX_ERROR) {
+            lex->failed = 1;
+            return n ? (ptrdiff_t)n : -1;
+        }
+        if(res == LEX_EOF)
+            break;
+        n++;
+    }
+    return n;
+}
+
+// lengths of compact lexemes take 32 bits
+static int lexer_compact(lexer_t *lex, lexer_tok_t *t, size_t pos, lexeme_t *m) {
+    size_t line, col;
+    if(m->str_len > UINT_MAX) {
+        if(!lex->quiet) {
+            lexer_pos(lex, pos, &line, &col);
+            fprintf(stderr, "%lu:%lu lexeme is too long\n", line, col);
+        }
+        return 0;
+    }
+    *t = (lexer_tok_t){ pos, m->str_len, m->class };
+    return 1;
+}
+
+ptrdiff_t lexer_next_toks_compact(lexer_t *lex, lexer_tok_t *out, size_t cap) {
+    size_t n = 0, pos;
+    lexeme_t m;
+    if(lex->failed)
+        return -1;
+    lexer_cur = lex;
+    while(n < cap) {
+        lexer_res_t res = lexer_tok(lex, &m, &pos);
+        if(res == LEX_EOF)
+            break;
+        if(res == LEX_ERROR || !lexer_compact(lex, &out[n], pos, &m)) {
+            lex->failed = 1;
+            return n ? (ptrdiff_t)n : -1;
+        }
+        n++;
+    }
+    return n;
+}
+
+// lexemes are only fed to it by lexer_feed
+lexer_t* lexer_create_push(void) {
+    return lexer_alloc();
+}
+
+static int lexer_reserve(lexer_t *lex, size_t num_bytes) {
+    if(num_bytes <= lex->max_bytes)
+        return 1;
+    while(num_bytes > lex->max_bytes)
+        lex->max_bytes <<= 1;
+    char *tmp = realloc(lex->symtab, lex->max_bytes);
+    if(!tmp) {
+        perror("realloc");
+        return 0;
+    }
+    lex->symtab = tmp;
+    return 1;
+}
+
+// runs the action of a lexeme completed by lexer_feed, lexemes of
+// classes other than 0 are kept in push_toks
+static int lexer_feed_tok(lexer_t *lex, lexer_action_t target, const char *str, size_t len, size_t *n) {
+    if(*n == lex->max_push_toks) {
+        size_t new_max = *n ? *n << 1 : 64;
+        lexeme_t *tmp = realloc(lex->push_toks, new_max*sizeof(lexeme_t));
+        if(!tmp) {
+            perror("realloc");
+            return 0;
+        }
+        lex->push_toks = tmp;
+        lex->max_push_toks = new_max;
+    }
+    lexeme_t *m = lex->push_toks + *n;
+    m->str = (char*)str;
+    m->str_len = len;
+    int class = target(m);
+    if(class < 0)
+        return 0;
+    if(class > 0) {
+        m->class = class;
+        (*n)++;
+    }
+    return 1;
+}
+
+// the automaton stops at the end of buf in the middle of a lexeme and
+// goes on from there in the next call. Only bytes of such lexemes are
+// copied to symtab, they are kept there until the next call, so lexemes
+// point either into buf or into symtab. Errors are returned like by
+// lexer_next_toks.
+ptrdiff_t lexer_feed(lexer_t *lex, const char *buf, size_t len, lexeme_t **toks) {
+    const unsigned char *in = (const unsigned char*)buf;
+    size_t n = 0, pos = 0, start = 0, used, scanned, off, toff;
+    lexer_action_t t;
+
+    *toks = lex->push_toks;
+    if(lex->failed)
+        return -1;
+    lexer_cur = lex;
+    size_t feed_off = lex->lines_off, sym_off = feed_off - lex->num_bytes;
+    if(buf && !lexer_index(lex, buf, len))
+        goto error;
+
+    // room for all of buf, symtab isn't moved while lexemes point into it
+    if(lex->num_bytes > 0) {
+        memmove(lex->symtab, lex->symtab + lex->push_start, lex->num_bytes);
+        if(!lexer_reserve(lex, lex->num_bytes + len))
+            goto error;
+    }
+    used = scanned = lex->num_bytes;
+
+    // the lexeme in symtab[start..used) comes before buf, bytes after
+    // scanned weren't scanned since the last lexeme ended
+    while(lex->num_bytes > 0) {
+        size_t p = lex->num_bytes;
+        const char *str = lex->symtab + start;
+        off = p;
+        if(scanned < p) {
+            t = NULL;
+            scanned = lexer_scan(lex, &lex->push_state, (const unsigned char*)str, scanned, p, &t, &toff);
+            if(t) {
+                lex->push_target = t;
+                lex->push_targ_len = toff;
+            }
+        }
+        if(scanned == p) {
+            t = NULL;
+            off = lexer_scan(lex, &lex->push_state, in, 0, len, &t, &toff);
+            if(t) {
+                lex->push_target = t;
+                lex->push_targ_len = p + toff;
+            }
+            if(off == len && buf) {
+                memcpy(lex->symtab + used, buf, len);
+                lex->num_bytes += len;
+                lex->push_start = start;
+                goto exit;
+            }
+        }
+
+        // dead state or end of input
+        if(!lex->push_target) {
+            if(scanned < p) {
+                lexer_error(lex, sym_off + start + scanned, str[scanned]);
+                goto error;
+            }
+            if(off < len) {
+                lexer_error(lex, feed_off + off, buf[off]);
+                goto error;
+            }
+            lex->num_bytes = 0;
+            break;
+        }
+
+        size_t targ_len = lex->push_targ_len;
+        if(targ_len > p) {
+            memcpy(lex->symtab + used, buf, targ_len - p);
+            used += targ_len - p;
+        }
+        if(!lexer_feed_tok(lex, lex->push_target, str, targ_len, &n))
+            goto error;
+        if(targ_len >= p) {
+            pos = targ_len - p;
+            lex->num_bytes = 0;
+        } else {
+            start += targ_len;
+            lex->num_bytes = p - targ_len;
+        }
+        scanned = 0;
+        lex->push_state = 0;
+        lex->push_target = NULL;
+    }
+
+    while(pos < len) {
+        int state = 0;
+        t = NULL;
+        off = lexer_scan(lex, &state, in, pos, len, &t, &toff);
+        if(off == len) {
+            if(!lexer_reserve(lex, used + len - pos))
+                goto error;
+            memcpy(lex->symtab + used, buf + pos, len - pos);
+            lex->push_start = used;
+            lex->num_bytes = len - pos;
+            lex->push_state = state;
+            lex->push_target = t;
+            lex->push_targ_len = t ? toff - pos : 0;
+            break;
+        }
+        if(!t) {
+            lexer_error(lex, feed_off + off, buf[off]);
+            goto error;
+        }
+        if(!lexer_feed_tok(lex, t, buf + pos, toff - pos, &n))
+            goto error;
+        pos = toff;
+    }
+
+exit:
+    *toks = lex->push_toks;
+    return n;
+error:
+    lex->failed = 1;
+    *toks = lex->push_toks;
+    return n ? (ptrdiff_t)n : -1;
+}
+
 void lexer_free(lexer_t *lex) {
-    close(lex->fd);
+    if(lex->fd >= 0)
+        close(lex->fd);
+    if(lex->mapped)
+        munmap((void*)lex->data, lex->data_len);
     free(lex->symtab);
+    if(lex->lines) free(lex->lines);
+    if(lex->replay) free(lex->replay);
+    if(lex->push_toks) free(lex->push_toks);
+    if(lex->str) free(lex->str);
+    lexer_engine_free(lex);
     free(lex);
 }
+
+// chunk of lexer_lex_parallel, which a thread lexes from start as if a
+// lexeme started there
+typedef struct {
+    const char    *data;
+    size_t        len, start, end;
+    lexer_chunk_t *chunk;
+    size_t        max_toks;
+    // start of the first lexeme at or after end, if the chunk didn't fail
+    size_t        next;
+    int           failed;
+} lexer_par_t;
+
+static int lexer_chunk_push(lexer_chunk_t *c, size_t *max_toks, lexer_tok_t tok) {
+    if(c->num_toks == *max_toks) {
+        size_t new_max = *max_toks ? *max_toks << 1 : 1024;
+        lexer_tok_t *tmp = realloc(c->toks, new_max*sizeof(lexer_tok_t));
+        if(!tmp) {
+            perror("realloc");
+            return 0;
+        }
+        c->toks = tmp;
+        *max_toks = new_max;
+    }
+    c->toks[c->num_toks++] = tok;
+    return 1;
+}
+
+static void* lexer_par_run(void *arg) {
+    lexer_par_t *p = arg;
+    lexer_tok_t tok;
+    lexeme_t m;
+    size_t pos;
+
+    p->failed = 1;
+    lexer_t *lex = lexer_create_buffer(p->data + p->start, p->len - p->start);
+    if(!lex)
+        return NULL;
+    // a wrong guess of the start may run into errors which aren't there
+    lex->quiet = 1;
+    lex->prof_off = 1;
+    lexer_cur = lex;
+    for(;;) {
+        lexer_res_t res = lexer_tok(lex, &m, &pos);
+        if(res == LEX_ERROR)
+            goto exit;
+        if(res == LEX_EOF) {
+            p->next = p->len;
+            break;
+        }
+        pos += p->start;
+        if(pos >= p->end) {
+            p->next = pos;
+            break;
+        }
+        if(!lexer_compact(lex, &tok, pos, &m) || !lexer_chunk_push(p->chunk, &p->max_toks, tok))
+            goto exit;
+    }
+    p->failed = 0;
+exit:
+    lexer_free(lex);
+    return NULL;
+}
+
+// lexes the true lexemes of chunk p from next, until one of them starts
+// where a lexeme of the chunk does, then the rest of the chunk is right.
+// next becomes the start of the first lexeme after the chunk.
+static lexer_res_t lexer_par_fix(lexer_t *fix, lexer_par_t *p, size_t *next) {
+    lexer_chunk_t res = { NULL, 0 };
+    size_t max_toks = 0, j = 0, pos, from = *next;
+    lexer_tok_t tok;
+    lexeme_t m;
+
+    fix->buf_off = from;
+    for(;;) {
+        lexer_res_t r = lexer_tok(fix, &m, &pos);
+        if(r == LEX_ERROR)
+            goto error;
+        if(r == LEX_EOF || pos >= p->end) {
+            *next = r == LEX_EOF ? p->len : pos;
+            break;
+        }
+        while(!p->failed && j < p->chunk->num_toks && p->chunk->toks[j].off < pos)
+            j++;
+        if(!p->failed && j < p->chunk->num_toks && p->chunk->toks[j].off == pos) {
+            for(; j < p->chunk->num_toks; j++) {
+                if(!lexer_chunk_push(&res, &max_toks, p->chunk->toks[j]))
+                    goto fail;
+            }
+            *next = p->next;
+            break;
+        }
+        if(!lexer_compact(fix, &tok, pos, &m)) {
+            // lexemes of fix are true ones, so it's reported
+            fix->quiet = 0;
+            lexer_compact(fix, &tok, pos, &m);
+            goto fail;
+        }
+        if(!lexer_chunk_push(&res, &max_toks, tok))
+            goto fail;
+    }
+    free(p->chunk->toks);
+    *p->chunk = res;
+    return LEX_SUCCESS;
+
+error:
+    // the error is lexed again to report it
+    fix->quiet = 0;
+    fix->buf_off = from;
+    fix->num_bytes = 0;
+    while(lexer_tok(fix, &m, &pos) == LEX_SUCCESS)
+        ;
+fail:
+    free(res.toks);
+    return LEX_ERROR;
+}
+
+// chunks start after a newline, where a lexeme most likely starts too.
+// Every chunk is lexed by its own thread, then their lexemes are checked
+// in order against the end of the previous chunk and lexed again up to
+// the first common lexeme if the guess was wrong.
+lexer_res_t lexer_lex_parallel(const char *data, size_t len, lexer_chunk_t *chunks, size_t num_chunks) {
+    lexer_res_t res = LEX_ERROR;
+    lexer_par_t *pars = NULL;
+    pthread_t *threads = NULL;
+    int *started = NULL;
+    lexer_t *fix = NULL;
+    size_t next = 0;
+
+    // there is nowhere to store lexemes
+    if(num_chunks == 0)
+        return LEX_ERROR;
+    for(size_t k = 0; k < num_chunks; k++) {
+        chunks[k].toks = NULL;
+        chunks[k].num_toks = 0;
+    }
+    pars = malloc(num_chunks*sizeof(lexer_par_t));
+    threads = malloc(num_chunks*sizeof(pthread_t));
+    started = calloc(num_chunks, sizeof(int));
+    if(!pars || !threads || !started) {
+        perror("malloc");
+        goto exit;
+    }
+
+    for(size_t k = 0; k < num_chunks; k++) {
+        size_t start = k ? pars[k-1].end : 0, end = len;
+        if(k+1 < num_chunks) {
+            end = len / num_chunks * (k+1);
+            const char *nl = end < len ? memchr(data + end, '\n', len - end) : NULL;
+            end = nl ? (size_t)(nl - data) + 1 : len;
+            if(end < start)
+                end = start;
+        }
+        pars[k] = (lexer_par_t){ data, len, start, end, &chunks[k], 0, len, 1 };
+    }
+    for(size_t k = 1; k < num_chunks; k++)
+        started[k] = pthread_create(&threads[k], NULL, lexer_par_run, &pars[k]) == 0;
+    lexer_par_run(&pars[0]);
+    for(size_t k = 1; k < num_chunks; k++) {
+        if(started[k])
+            pthread_join(threads[k], NULL);
+        else
+            lexer_par_run(&pars[k]);
+    }
+
+    fix = lexer_create_buffer(data, len);
+    if(!fix)
+        goto exit;
+    fix->quiet = 1;
+    fix->prof_off = 1;
+    lexer_cur = fix;
+    for(size_t k = 0; k < num_chunks; k++) {
+        lexer_par_t *p = &pars[k];
+        // a lexeme of previous chunks covers this one
+        if(next >= p->end) {
+            chunks[k].num_toks = 0;
+            continue;
+        }
+        if(!p->failed && (k == 0 || (chunks[k].num_toks > 0 && chunks[k].toks[0].off == next) ||
+                          (chunks[k].num_toks == 0 && p->next == next))) {
+            next = p->next;
+            continue;
+        }
+        if(lexer_par_fix(fix, p, &next) != LEX_SUCCESS)
+            goto exit;
+    }
+    res = LEX_SUCCESS;
+
+exit:
+    if(res != LEX_SUCCESS) {
+        for(size_t k = 0; k < num_chunks; k++) {
+            free(chunks[k].toks);
+            chunks[k].toks = NULL;
+            chunks[k].num_toks = 0;
+        }
+    }
+    if(fix) lexer_free(fix);
+    if(pars) free(pars);
+    if(threads) free(threads);
+    if(started) free(started);
+    return res;
+}
@@ -26,14 +26,67 @@ typedef struct {
     int fd;
     int cur_buf;
     char buf[8192];
+    size_t buf_len[2];
+    // offsets of the halves from the start of input
+    size_t buf_pos[2];
+    int ahead;
+    // lookahead scanned again after its half was read over
+    char *replay;
+    size_t replay_len, replay_off, max_replay;
+    // a batch stopped by an error, which the next batch returns
+    int failed;
+    // errors aren't printed
+    int quiet;
+    // a profiling build doesn't count bytes of this lexer
+    int prof_off;
     char *symtab;
     size_t max_bytes, num_bytes;
-    size_t buf_off, read_len;
-    size_t cur_line, cur_chr;
+    size_t buf_off;
+    // whole input mapped by lexer_create_mmap or given to
+    // lexer_create_buffer, NULL if it's read into buf
+    const char *data;
+    size_t data_len;
+    int mapped;
+    // offsets after the newlines of the first lines_off bytes of input
+    size_t *lines;
+    size_t num_lines, max_lines, lines_off;
+    // lexeme fed to lexer_feed so far is symtab[push_start..], the
+    // automaton is in push_state after it and push_target accepted
+    // its first push_targ_len bytes
+    size_t push_start;
+    int push_state;
+    int (*push_target)(lexeme_t*);
+    size_t push_targ_len;
+    lexeme_t *push_toks;
+    size_t max_push_toks;
+    // copy of lexer_str
+    char *str;
+    size_t max_str;
 } lexer_t;
 
 typedef enum { LEX_ERROR = -1, LEX_SUCCESS = 0, LEX_EOF = 1 } lexer_res_t;
 
+// lexeme of lexer_next_toks_compact, off is from the start of input
+typedef struct {
+    size_t off;
+    unsigned int len;
+    int class;
+} lexer_tok_t;
+
+// lexemes of lexer_lex_parallel which start in one chunk of input
+typedef struct {
+    lexer_tok_t *toks;
+    size_t num_toks;
+} lexer_chunk_t;
+
 lexer_t* lexer_create(const char *filename);
+lexer_t* lexer_create_mmap(const char *filename);
+lexer_t* lexer_create_buffer(const char *data, size_t len);
 lexer_res_t lexer_next_tok(lexer_t *lex, lexeme_t *m);
+ptrdiff_t lexer_next_toks(lexer_t *lex, lexeme_t *out, size_t cap);
+ptrdiff_t lexer_next_toks_compact(lexer_t *lex, lexer_tok_t *out, size_t cap);
+lexer_t* lexer_create_push(void);
+ptrdiff_t lexer_feed(lexer_t *lex, const char *buf, size_t len, lexeme_t **toks);
+void lexer_pos(lexer_t *lex, size_t off, size_t *line, size_t *col);
+lexer_res_t lexer_lex_parallel(const char *data, size_t len, lexer_chunk_t *chunks, size_t num_chunks);
 void lexer_free(lexer_t *lex);
@@ -4,7 +4,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-static size_t primes[] = {13, 31, 61, 103, 229, 523, 1093, 2239, 4519, 9043, 18121, 36343, 72673, 145513, 291043, 582139, 1164433};
+#define MIN_SIZE 8
+// grow when more than 7/8 of the slots are used
+#define OVERLOADED(n, size) ((n)*8 > (size)*7)
+#define NODE(h, i) ((hnode_t*)((h)->nodes + (i)*(h)->node_size))
 
 uint32_t default_hash_func(const uint8_t *key, size_t length) {
     size_t i = 0;
@@ -20,6 +23,91 @@ uint32_t default_hash_func(const uint8_t *key, size_t length) {
     return hash;
 }
 
+// murmur3 64-bit finalizer, all pointer bits affect the result
+uint32_t ptr_hash_func(const void *ptr) {
+    uint64_t k = (uint64_t)(uintptr_t)ptr;
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return (uint32_t)k;
+}
+
+// slots are picked by the low bits, so weak user hashes are mixed first
+static inline uint32_t mix_hash(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static bool htable_alloc_slots(htable_t *htable, size_t size) {
+    htable->nodes = malloc(size*htable->node_size);
+    htable->dists = calloc(size, sizeof(uint32_t));
+    if(!htable->nodes || !htable->dists) {
+        perror("malloc");
+        if(htable->nodes) free(htable->nodes);
+        if(htable->dists) free(htable->dists);
+        return false;
+    }
+    htable->max_nodes = size;
+    htable->mask = size-1;
+    return true;
+}
+
+// node->hash must be set and the key must not be in the table
+static void htable_place(htable_t *htable, hnode_t *node) {
+    size_t node_size = htable->node_size;
+    char *cur = htable->tmp, *swap = htable->tmp + node_size, *t;
+    size_t i = node->hash & htable->mask;
+    uint32_t dist = 1;
+
+    memcpy(cur, node, node_size);
+    for(;;) {
+        uint32_t slot_dist = htable->dists[i];
+        if(slot_dist == 0) {
+            memcpy(NODE(htable, i), cur, node_size);
+            htable->dists[i] = dist;
+            htable->num_nodes++;
+            return;
+        }
+        // take the slot from a node that is closer to its home
+        if(slot_dist < dist) {
+            memcpy(swap, NODE(htable, i), node_size);
+            memcpy(NODE(htable, i), cur, node_size);
+            htable->dists[i] = dist;
+            t = cur; cur = swap; swap = t;
+            dist = slot_dist;
+        }
+        i = (i+1) & htable->mask;
+        dist++;
+    }
+}
+
+static bool htable_grow(htable_t *htable) {
+    char *old_nodes = htable->nodes;
+    uint32_t *old_dists = htable->dists;
+    size_t old_size = htable->max_nodes;
+
+    if(!htable_alloc_slots(htable, old_size*2)) {
+        htable->nodes = old_nodes;
+        htable->dists = old_dists;
+        return false;
+    }
+
+    htable->num_nodes = 0;
+    for(size_t i = 0; i < old_size; i++) {
+        if(old_dists[i])
+            htable_place(htable, (hnode_t*)(old_nodes + i*htable->node_size));
+    }
+    free(old_nodes);
+    free(old_dists);
+    return true;
+}
+
 htable_t* htable_create(size_t node_size, size_t max_nodes, htable_hash_func hash_func, htable_keyeq_func keyeq_func, htable_free_func free_func) {
     htable_t *htable = malloc(sizeof(htable_t));
     if(!htable) {
@@ -27,30 +115,24 @@ htable_t* htable_create(size_t node_size, size_t max_nodes, htable_hash_func has
         return NULL;
     }
 
-    bool size_found = false;
-    for(int i = 0; i < sizeof(primes)/sizeof(*primes); i++) {
-        if(primes[i] >= max_nodes) {
-            htable->max_nodes = primes[i];
-            htable->size_ind = i;
-            size_found = true;
-            break;
-        }
-    }
-
-    if(!size_found) {
-        fprintf(stderr, "size %lu is too big\n", max_nodes);
+    htable->tmp = malloc(node_size*2);
+    if(!htable->tmp) {
+        perror("malloc");
         free(htable);
         return NULL;
     }
 
-    htable->nodes = calloc(htable->max_nodes, sizeof(hnode_t*));
-    if(!htable->nodes) {
-        perror("calloc");
+    size_t size = MIN_SIZE;
+    while(OVERLOADED(max_nodes, size))
+        size <<= 1;
+
+    htable->node_size = node_size;
+    if(!htable_alloc_slots(htable, size)) {
+        free(htable->tmp);
         free(htable);
         return NULL;
     }
 
-    htable->node_size = node_size;
     htable->num_nodes = 0;
     htable->hash_func = hash_func;
     htable->keyeq_func = keyeq_func;
@@ -59,119 +141,55 @@ htable_t* htable_create(size_t node_size, size_t max_nodes, htable_hash_func has
     return htable;
 }
 
-bool htable_insert(htable_t *htable, hnode_t *node) {
-    int cur, step, nstep;
-    hnode_t *cur_node, *new_node;
-
-    if(htable->num_nodes == htable->max_nodes) {
-        int new_ind = htable->size_ind+1;
-        size_t old_size, new_size;
-
-        if(new_ind == sizeof(primes)/sizeof(*primes)) {
-            fprintf(stderr, "Failed to insert: size %lu is maximum\n", htable->max_nodes);
-            return false;
-        }
-        new_size = primes[new_ind];
-        old_size = htable->max_nodes;
-        hnode_t **new_nodes = calloc(new_size, sizeof(hnode_t*));
-        if(!new_nodes) {
-            perror("calloc");
-            return false;
-        }
+static hnode_t* htable_find(htable_t *htable, hnode_t *node, uint32_t hash) {
+    size_t i = hash & htable->mask;
+    uint32_t dist = 1;
 
-        for(size_t i = 0; i < old_size; i++) {
-            cur_node = htable->nodes[i];
-            cur = cur_node->hash % new_size;
-            step = cur_node->hash % (new_size-2) + 1;
-            nstep = step;
-            for(size_t j = 0; j < new_size; j++) {
-                if(!new_nodes[cur]) {
-                    new_nodes[cur] = cur_node;
-                    break;
-                }
-                cur = (cur_node->hash + nstep) % new_size;
-                nstep += step;
-            }
-        }
-        free(htable->nodes);
-
-        htable->size_ind = new_ind;
-        htable->max_nodes = new_size;
-        htable->nodes = new_nodes;
+    // robin hood invariant: the key can't be behind a node closer to its home
+    while(htable->dists[i] >= dist) {
+        hnode_t *cur_node = NODE(htable, i);
+        if(cur_node->hash == hash && htable->keyeq_func(cur_node, node))
+            return cur_node;
+        i = (i+1) & htable->mask;
+        dist++;
     }
 
-    new_node = malloc(htable->node_size);
-    if(!new_node) {
-        perror("malloc");
-        return false;
-    }
-    memcpy(new_node, node, htable->node_size);
-    new_node->hash = htable->hash_func(node);
-
-    bool is_inserted = false;
-
-    cur = new_node->hash % htable->max_nodes;
-    step = new_node->hash % (htable->max_nodes-2) + 1;
-    nstep = step;
-    for(size_t i = 0; i < htable->max_nodes; i++) {
-        cur_node = htable->nodes[cur];
-        if(!cur_node) {
-            htable->nodes[cur] = new_node;
-            htable->num_nodes++;
-            is_inserted = true;
-            break;
-        }
-        if(cur_node->hash == new_node->hash &&
-           htable->keyeq_func(cur_node, new_node)) {
-            if(htable->free_func)
-                htable->free_func(cur_node);
-            free(cur_node);
-            htable->nodes[cur] = new_node;
-            is_inserted = true;
-            break;
-        }
+    return NULL;
+}
 
-        cur = (new_node->hash + nstep) % htable->max_nodes;
-        nstep += step;
+bool htable_insert(htable_t *htable, hnode_t *node) {
+    uint32_t hash = mix_hash(htable->hash_func(node));
+    hnode_t *found_node = htable_find(htable, node, hash);
+
+    if(found_node) {
+        if(htable->free_func)
+            htable->free_func(found_node);
+        memcpy(found_node, node, htable->node_size);
+        found_node->hash = hash;
+        return true;
     }
 
-    if(!is_inserted) {
-        fputs("Internal error: failed to insert node\n", stderr);
+    if(OVERLOADED(htable->num_nodes+1, htable->max_nodes) && !htable_grow(htable))
         return false;
-    }
 
+    node->hash = hash;
+    htable_place(htable, node);
     return true;
 }
 
 hnode_t* htable_lookup(htable_t *htable, hnode_t *node) {
-    uint32_t hash = htable->hash_func(node);
-    int cur = hash % htable->max_nodes;
-    int step = hash % (htable->max_nodes-2) + 1;
-    int nstep = step;
-    hnode_t *cur_node;
-
-    for(size_t i = 0; i < htable->max_nodes; i++) {
-        cur_node = htable->nodes[cur];
-        if(!cur_node)
-            break;
-        if(cur_node->hash == hash &&
-           htable->keyeq_func(cur_node, node))
-            return cur_node;
-        cur = (hash + nstep) % htable->max_nodes;
-        nstep += step;
-    }
-
-    return NULL;
+    return htable_find(htable, node, mix_hash(htable->hash_func(node)));
 }
 
 void htable_free(htable_t *htable) {
-    for(size_t i = 0; i < htable->max_nodes; i++) {
-        if(!htable->nodes[i])
-            continue;
-        if(htable->free_func)
-            htable->free_func(htable->nodes[i]);
-        free(htable->nodes[i]);
+    if(htable->free_func) {
+        for(size_t i = 0; i < htable->max_nodes; i++) {
+            if(htable->dists[i])
+                htable->free_func(NODE(htable, i));
+        }
     }
     free(htable->nodes);
+    free(htable->dists);
+    free(htable->tmp);
     free(htable);
 }
@@ -11,12 +11,17 @@ typedef struct {
 typedef uint32_t (*htable_hash_func)(hnode_t*);
 typedef bool (*htable_keyeq_func)(hnode_t*, hnode_t*);
 typedef void (*htable_free_func)(hnode_t*);
+
+// Open addressing with robin hood probing. Nodes are stored inline, so
+// pointers returned by htable_lookup are valid only until the next insert.
 typedef struct {
-    hnode_t **nodes;
-    size_t  node_size;
-    size_t  num_nodes;
-    size_t  max_nodes;
-    int     size_ind;
+    char     *nodes;
+    uint32_t *dists; // probe distance + 1, 0 is an empty slot
+    char     *tmp;
+    size_t   node_size;
+    size_t   num_nodes;
+    size_t   max_nodes;
+    size_t   mask;
 
     htable_hash_func  hash_func;
     htable_keyeq_func keyeq_func;
@@ -24,6 +29,7 @@ typedef struct {
 } htable_t;
 
 uint32_t default_hash_func(const uint8_t *key, size_t length);
+uint32_t ptr_hash_func(const void *ptr);
 
 htable_t* htable_create(size_t node_size, size_t max_nodes, htable_hash_func hash_func, htable_keyeq_func keyeq_func, htable_free_func free_func);
 bool htable_insert(htable_t *htable, hnode_t *node);
@@ -0,0 +1,342 @@
+#include "keyword.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "posset.h"
+
+// rule is a keyword candidate until kw_resolve finds its host
+#define KW_PENDING UINT32_MAX
+// hash-and-displace gives up after this many seeds for one bucket
+#define KW_MAX_DISP (1u << 24)
+
+// FNV-1a with a seed and murmur3 finalizer, lexer_c_kw computes the same
+static uint32_t kw_hash(const char *str, size_t len, uint32_t seed) {
+    uint32_t hash = 0x811c9dc5 ^ seed;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 0x01000193;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static size_t tree_len(syn_tree_t *t) {
+    if(t->tag == SYM)
+        return 1;
+    if(t->tag == AND)
+        return tree_len(t->and.s1) + tree_len(t->and.s2);
+    return 0;
+}
+
+// concatenation of single characters, false for anything else
+static bool tree_literal(syn_tree_t *t, char *str, size_t *len) {
+    if(t->tag == AND)
+        return tree_literal(t->and.s1, str, len) && tree_literal(t->and.s2, str, len);
+    if(t->tag != SYM)
+        return false;
+
+    int c, found = -1;
+    for(c = 0; c < 256; c++) {
+        if(!charset_has(&t->sym.set, c))
+            continue;
+        if(found >= 0)
+            return false;
+        found = c;
+    }
+    if(found < 0)
+        return false;
+    str[(*len)++] = found;
+    return true;
+}
+
+kw_set_t* kw_find(arena_t *arena, regexp_func_t *funcs, size_t num_funcs) {
+    syn_tree_t *t;
+    size_t off, len;
+    bool error = false;
+
+    kw_set_t *kw = arena_calloc(arena, 1, sizeof(kw_set_t));
+    if(!kw)
+        return NULL;
+    kw->num_funcs = num_funcs;
+    kw->strs = arena_calloc(arena, num_funcs, sizeof(char*));
+    kw->lens = arena_calloc(arena, num_funcs, sizeof(size_t));
+    kw->hosts = arena_calloc(arena, num_funcs, sizeof(uint32_t));
+    if(!kw->strs || !kw->lens || !kw->hosts)
+        return NULL;
+
+    for(size_t i = 0; i < num_funcs; i++) {
+        t = parse_regexp(arena, funcs[i].regexp, funcs[i].regexp_len, &off, &error);
+        if(error)
+            return NULL;
+        if(!t) {
+            fprintf(stderr, "Regexp of rule %lu is empty\n", i+1);
+            return NULL;
+        }
+
+        len = tree_len(t);
+        if(len == 0)
+            continue;
+        char *str = arena_alloc(arena, len);
+        if(!str)
+            return NULL;
+        len = 0;
+        if(!tree_literal(t, str, &len))
+            continue;
+
+        kw->strs[i] = str;
+        kw->lens[i] = len;
+        kw->hosts[i] = KW_PENDING;
+    }
+    return kw;
+}
+
+// Candidates are run on the position automaton built without them. A
+// keyword moves to its host if the host accepts it and the original
+// automaton would choose the keyword there: the smallest end marker isn't
+// a single character ending of an earlier rule. The rest are kept.
+bool kw_resolve(kw_set_t *kw, regexp_stat *st, regexp_func_t *funcs, size_t *num_kept) {
+    posset_t cur = {0}, next = {0}, tmp;
+    size_t num_rules = st->num_ends/2;
+
+    *num_kept = 0;
+    for(size_t i = 0; i < kw->num_funcs; i++) {
+        if(kw->hosts[i] != KW_PENDING)
+            continue;
+
+        if(!posset_copy(st->arena, &cur, &st->firstpos))
+            return false;
+        for(size_t j = 0; j < kw->lens[i] && cur.num_items > 0; j++) {
+            unsigned char c = kw->strs[i][j];
+            posset_clear(&next);
+            posset_for_each(p, &cur) {
+                if(*p < st->num_syms && charset_has(&st->syms[*p]->sym.set, c) &&
+                   !posset_union(st->arena, &next, &st->followpos[*p]))
+                    return false;
+            }
+            tmp = cur;
+            cur = next;
+            next = tmp;
+        }
+
+        size_t end = SIZE_MAX;
+        posset_for_each(p, &cur) {
+            if(*p >= st->num_syms) {
+                end = *p - st->num_syms;
+                break;
+            }
+        }
+
+        size_t host = end == SIZE_MAX ? i : (regexp_func_t*)st->end_targets[end] - funcs;
+        if(end == SIZE_MAX || (end < num_rules && host < i)) {
+            kw->hosts[i] = 0;
+            (*num_kept)++;
+        } else {
+            kw->hosts[i] = host+1;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    const char *str;
+    size_t     len;
+    size_t     rule;
+} kw_key_t;
+
+static int kw_key_cmp(const void *_k1, const void *_k2) {
+    const kw_key_t *k1 = _k1, *k2 = _k2;
+    if(k1->len != k2->len)
+        return k1->len < k2->len ? -1 : 1;
+    int res = memcmp(k1->str, k2->str, k1->len);
+    if(res)
+        return res;
+    return k1->rule < k2->rule ? -1 : k1->rule > k2->rule;
+}
+
+// hash-and-displace: keys are split into n buckets by the seed 0 hash,
+// then the biggest buckets first get a seed which puts all their keys
+// into free slots
+static bool kw_build_table(arena_t *arena, kw_table_t *tab, kw_key_t *keys, size_t n) {
+    size_t *bucket_of = arena_alloc(arena, n*sizeof(size_t));
+    size_t *order = arena_alloc(arena, n*sizeof(size_t));
+    size_t *sizes = arena_calloc(arena, n, sizeof(size_t));
+    size_t *start = arena_calloc(arena, n+1, sizeof(size_t));
+    size_t *fill = arena_alloc(arena, (n+1)*sizeof(size_t));
+    size_t *by_size = arena_alloc(arena, n*sizeof(size_t));
+    size_t *slots = arena_alloc(arena, n*sizeof(size_t));
+    bool *taken = arena_calloc(arena, n, sizeof(bool));
+    tab->rules = arena_alloc(arena, n*sizeof(size_t));
+    tab->disp = arena_calloc(arena, n, sizeof(uint32_t));
+    if(!bucket_of || !order || !sizes || !start || !fill || !by_size || !slots || !taken || !tab->rules || !tab->disp)
+        return false;
+    tab->num_rules = n;
+
+    // keys grouped by bucket
+    for(size_t i = 0; i < n; i++) {
+        bucket_of[i] = kw_hash(keys[i].str, keys[i].len, 0) % n;
+        sizes[bucket_of[i]]++;
+    }
+    for(size_t b = 0; b < n; b++) {
+        start[b+1] = start[b] + sizes[b];
+        fill[b] = start[b];
+    }
+    for(size_t i = 0; i < n; i++)
+        order[fill[bucket_of[i]]++] = i;
+
+    // buckets sorted by size, biggest first; fill counts buckets per size
+    memset(fill, 0, (n+1)*sizeof(size_t));
+    for(size_t b = 0; b < n; b++)
+        fill[n - sizes[b]]++;
+    for(size_t s = 1; s <= n; s++)
+        fill[s] += fill[s-1];
+    for(size_t b = n; b-- > 0; )
+        by_size[--fill[n - sizes[b]]] = b;
+
+    for(size_t k = 0; k < n; k++) {
+        size_t b = by_size[k], num = sizes[b];
+        size_t *bkeys = order + start[b];
+        uint32_t d;
+        if(num == 0)
+            break;
+
+        for(d = 1; d < KW_MAX_DISP; d++) {
+            size_t j;
+            for(j = 0; j < num; j++) {
+                slots[j] = kw_hash(keys[bkeys[j]].str, keys[bkeys[j]].len, d) % n;
+                if(taken[slots[j]])
+                    break;
+                taken[slots[j]] = true;
+            }
+            if(j == num)
+                break;
+            while(j-- > 0)
+                taken[slots[j]] = false;
+        }
+        if(d == KW_MAX_DISP) {
+            fprintf(stderr, "Can't build a perfect hash for keywords of rule %lu\n", tab->host);
+            return false;
+        }
+
+        tab->disp[b] = d;
+        for(size_t j = 0; j < num; j++)
+            tab->rules[slots[j]] = keys[bkeys[j]].rule;
+    }
+    return true;
+}
+
+bool kw_build(arena_t *arena, kw_set_t *kw) {
+    size_t *table_of, *num_keys;
+    kw_key_t **keys;
+
+    kw->num_tables = kw->num_folded = 0;
+    for(size_t i = 0; i < kw->num_funcs; i++)
+        kw->num_folded += kw->hosts[i] != 0;
+    if(kw->num_folded == 0)
+        return true;
+
+    table_of = arena_alloc(arena, kw->num_funcs*sizeof(size_t));
+    num_keys = arena_calloc(arena, kw->num_funcs, sizeof(size_t));
+    kw->tables = arena_alloc(arena, kw->num_funcs*sizeof(kw_table_t));
+    if(!table_of || !num_keys || !kw->tables)
+        return false;
+    memset(table_of, 0xff, kw->num_funcs*sizeof(size_t));
+
+    for(size_t i = 0; i < kw->num_funcs; i++) {
+        if(kw->hosts[i] == 0)
+            continue;
+        size_t host = kw->hosts[i]-1;
+        if(table_of[host] == SIZE_MAX) {
+            table_of[host] = kw->num_tables;
+            kw->tables[kw->num_tables++].host = host;
+        }
+        num_keys[table_of[host]]++;
+    }
+
+    keys = arena_alloc(arena, kw->num_tables*sizeof(kw_key_t*));
+    if(!keys)
+        return false;
+    for(size_t t = 0; t < kw->num_tables; t++) {
+        keys[t] = arena_alloc(arena, num_keys[t]*sizeof(kw_key_t));
+        if(!keys[t])
+            return false;
+        num_keys[t] = 0;
+    }
+    for(size_t i = 0; i < kw->num_funcs; i++) {
+        if(kw->hosts[i] == 0)
+            continue;
+        size_t t = table_of[kw->hosts[i]-1];
+        keys[t][num_keys[t]++] = (kw_key_t){ kw->strs[i], kw->lens[i], i };
+    }
+
+    for(size_t t = 0; t < kw->num_tables; t++) {
+        // a repeated keyword never matches, the earliest one is kept
+        size_t n = 0;
+        qsort(keys[t], num_keys[t], sizeof(kw_key_t), kw_key_cmp);
+        for(size_t i = 0; i < num_keys[t]; i++) {
+            if(n > 0 && keys[t][n-1].len == keys[t][i].len &&
+               !memcmp(keys[t][n-1].str, keys[t][i].str, keys[t][i].len))
+                continue;
+            keys[t][n++] = keys[t][i];
+        }
+        if(!kw_build_table(arena, &kw->tables[t], keys[t], n))
+            return false;
+    }
+    return true;
+}
+
+int kw_host_table(kw_set_t *kw, size_t rule) {
+    for(size_t t = 0; t < kw->num_tables; t++) {
+        if(kw->tables[t].host == rule)
+            return t;
+    }
+    return -1;
+}
+
+static void gen_c_string(FILE *fd, const char *str, size_t len) {
+    fputc('"', fd);
+    for(size_t i = 0; i < len; i++) {
+        unsigned char c = str[i];
+        if(c < 32 || c > 126 || c == '"' || c == '\\' || c == '?')
+            fprintf(fd, "\\%03o", c);
+        else
+            fputc(c, fd);
+    }
+    fputc('"', fd);
+}
+
+// tables of every host and its action, which is emitted as f<host>_rule
+void kw_gen(FILE *fd, kw_set_t *kw) {
+    for(size_t t = 0; t < kw->num_tables; t++) {
+        kw_table_t *tab = &kw->tables[t];
+        size_t h = tab->host, n = tab->num_rules;
+
+        fprintf(fd, "\nstatic const char *const kw%lu_str[] = { ", h);
+        for(size_t i = 0; i < n; i++) {
+            gen_c_string(fd, kw->strs[tab->rules[i]], kw->lens[tab->rules[i]]);
+            fputs(i+1 < n ? ", " : " };\n", fd);
+        }
+
+        fprintf(fd, "static const size_t kw%lu_len[] = { ", h);
+        for(size_t i = 0; i < n; i++)
+            fprintf(fd, i+1 < n ? "%lu, " : "%lu };\n", kw->lens[tab->rules[i]]);
+
+        fprintf(fd, "static const lexer_action_t kw%lu_func[] = { ", h);
+        for(size_t i = 0; i < n; i++)
+            fprintf(fd, i+1 < n ? "f%lu, " : "f%lu };\n", tab->rules[i]);
+
+        fprintf(fd, "static const unsigned int kw%lu_disp[] = { ", h);
+        for(size_t i = 0; i < n; i++)
+            fprintf(fd, i+1 < n ? "%u, " : "%u };\n", tab->disp[i]);
+
+        fprintf(fd, "\nstatic int f%lu(lexeme_t *lex) {\n", h);
+        fprintf(fd, "    size_t slot = lexer_kw_hash(lex->str, lex->str_len, 0) %% %lu;\n", n);
+        fprintf(fd, "    slot = lexer_kw_hash(lex->str, lex->str_len, kw%lu_disp[slot]) %% %lu;\n", h, n);
+        fprintf(fd, "    if(kw%lu_len[slot] == lex->str_len && !memcmp(kw%lu_str[slot], lex->str, lex->str_len))\n", h, h);
+        fprintf(fd, "        return kw%lu_func[slot](lex);\n", h);
+        fprintf(fd, "    return f%lu_rule(lex);\n}\n", h);
+    }
+}
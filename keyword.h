@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "regexp.h"
+#include "trans.h"
+
+// Keywords are rules matching one fixed string. A keyword which is also
+// matched by a more general rule, its host, isn't put into the automaton:
+// the host's action looks the lexeme up in a minimal perfect hash and
+// calls the keyword action on a hit.
+typedef struct {
+    size_t   host;
+    size_t   *rules;
+    uint32_t *disp;
+    size_t   num_rules;
+} kw_table_t;
+
+typedef struct {
+    char       **strs;
+    size_t     *lens;
+    // per rule: 0 if the rule is in the automaton, host index+1 otherwise
+    uint32_t   *hosts;
+    size_t     num_funcs;
+    size_t     num_folded;
+    kw_table_t *tables;
+    size_t     num_tables;
+} kw_set_t;
+
+kw_set_t* kw_find(arena_t *arena, regexp_func_t *funcs, size_t num_funcs);
+bool kw_resolve(kw_set_t *kw, regexp_stat *st, regexp_func_t *funcs, size_t *num_kept);
+bool kw_build(arena_t *arena, kw_set_t *kw);
+int kw_host_table(kw_set_t *kw, size_t rule);
+void kw_gen(FILE *fd, kw_set_t *kw);
@@ -6,168 +6,1535 @@ static char *lexer_c_headers[] = {
     "stdio.h",
     "stdlib.h",
     "string.h",
+    "limits.h",
     "unistd.h",
-    "fcntl.h"
+    "fcntl.h",
+    "sys/mman.h",
+    "sys/stat.h",
+    "pthread.h"
 };
 
-static char lexer_h[] =
+static char *lexer_c_mmap_headers[] = {
+    "stdint.h"
+};
+
+// lexer_t is lexer_h_struct, fields of the engine and lexer_h
+static char lexer_h_struct[] =
 "typedef struct {\n"
 "    int fd;\n"
 "    int cur_buf;\n"
 "    char buf[8192];\n"
+"    size_t buf_len[2];\n"
+"    // offsets of the halves from the start of input\n"
+"    size_t buf_pos[2];\n"
+"    int ahead;\n"
+"    // lookahead scanned again after its half was read over\n"
+"    char *replay;\n"
+"    size_t replay_len, replay_off, max_replay;\n"
+"    // a batch stopped by an error, which the next batch returns\n"
+"    int failed;\n"
+"    // errors aren't printed\n"
+"    int quiet;\n"
+"    // a profiling build doesn't count bytes of this lexer\n"
+"    int prof_off;\n"
 "    char *symtab;\n"
 "    size_t max_bytes, num_bytes;\n"
-"    size_t buf_off, read_len;\n"
-"    size_t cur_line, cur_chr;\n"
+"    size_t buf_off;\n"
+"    // whole input mapped by lexer_create_mmap or given to\n"
+"    // lexer_create_buffer, NULL if it's read into buf\n"
+"    const char *data;\n"
+"    size_t data_len;\n"
+"    int mapped;\n"
+"    // offsets after the newlines of the first lines_off bytes of input\n"
+"    size_t *lines;\n"
+"    size_t num_lines, max_lines, lines_off;\n"
+"    // lexeme fed to lexer_feed so far is symtab[push_start..], the\n"
+"    // automaton is in push_state after it and push_target accepted\n"
+"    // its first push_targ_len bytes\n"
+"    size_t push_start;\n"
+"    int push_state;\n"
+"    int (*push_target)(lexeme_t*);\n"
+"    size_t push_targ_len;\n"
+"    lexeme_t *push_toks;\n"
+"    size_t max_push_toks;\n"
+"    // copy of lexer_str\n"
+"    char *str;\n"
+"    size_t max_str;\n";
+
+static char lexer_h[] =
 "} lexer_t;\n"
 "\n"
 "typedef enum { LEX_ERROR = -1, LEX_SUCCESS = 0, LEX_EOF = 1 } lexer_res_t;\n"
 "\n"
+"// lexeme of lexer_next_toks_compact, off is from the start of input\n"
+"typedef struct {\n"
+"    size_t off;\n"
+"    unsigned int len;\n"
+"    int class;\n"
+"} lexer_tok_t;\n"
+"\n"
+"// lexemes of lexer_lex_parallel which start in one chunk of input\n"
+"typedef struct {\n"
+"    lexer_tok_t *toks;\n"
+"    size_t num_toks;\n"
+"} lexer_chunk_t;\n"
+"\n"
 "lexer_t* lexer_create(const char *filename);\n"
+"lexer_t* lexer_create_mmap(const char *filename);\n"
+"lexer_t* lexer_create_buffer(const char *data, size_t len);\n"
 "lexer_res_t lexer_next_tok(lexer_t *lex, lexeme_t *m);\n"
+"ptrdiff_t lexer_next_toks(lexer_t *lex, lexeme_t *out, size_t cap);\n"
+"ptrdiff_t lexer_next_toks_compact(lexer_t *lex, lexer_tok_t *out, size_t cap);\n"
+"lexer_t* lexer_create_push(void);\n"
+"ptrdiff_t lexer_feed(lexer_t *lex, const char *buf, size_t len, lexeme_t **toks);\n"
+"void lexer_pos(lexer_t *lex, size_t off, size_t *line, size_t *col);\n"
+"lexer_res_t lexer_lex_parallel(const char *data, size_t len, lexer_chunk_t *chunks, size_t num_chunks);\n"
 "void lexer_free(lexer_t *lex);\n";
 
+static char lexer_c_str[] =
+"\n"
+"// lexer which runs actions in this thread\n"
+"static _Thread_local lexer_t *lexer_cur;\n"
+"\n"
+"// lexemes point into the input and aren't terminated by zero, lexer_str\n"
+"// returns a terminated copy for actions which need one. It's valid until\n"
+"// the next call of lexer_str.\n"
+"static inline char* lexer_str(lexeme_t *m) {\n"
+"    lexer_t *lex = lexer_cur;\n"
+"    if(m->str_len + 1 > lex->max_str) {\n"
+"        size_t max = lex->max_str ? lex->max_str : 32;\n"
+"        while(m->str_len + 1 > max)\n"
+"            max <<= 1;\n"
+"        char *tmp = realloc(lex->str, max);\n"
+"        if(!tmp) {\n"
+"            perror(\"realloc\");\n"
+"            return NULL;\n"
+"        }\n"
+"        lex->str = tmp;\n"
+"        lex->max_str = max;\n"
+"    }\n"
+"    memcpy(lex->str, m->str, m->str_len);\n"
+"    lex->str[m->str_len] = 0;\n"
+"    return lex->str;\n"
+"}\n";
+
 static char lexer_c[] =
-"lexer_t* lexer_create(const char *filename) {\n"
-"    lexer_t *lex;\n"
-"    int fd = -1;\n"
+"#define LEXER_HALF (sizeof(((lexer_t*)0)->buf)/2)\n"
 "\n"
-"    lex = malloc(sizeof(lexer_t));\n"
+"static lexer_t* lexer_alloc(void) {\n"
+"    lexer_t *lex = malloc(sizeof(lexer_t));\n"
 "    if(!lex) {\n"
 "        perror(\"malloc\");\n"
-"        goto exit;\n"
-"    }\n"
-"    lex->symtab = NULL;\n"
-"\n"
-"    fd = open(filename, O_RDONLY);\n"
-"    if(fd < 0) {\n"
-"        perror(\"open\");\n"
-"        goto exit;\n"
+"        return NULL;\n"
 "    }\n"
-"    lex->fd = fd;\n"
-"\n"
+"    lex->fd = -1;\n"
+"    lex->data = NULL;\n"
+"    lex->mapped = 0;\n"
 "    lex->cur_buf = 1;\n"
+"    lex->buf_len[0] = lex->buf_len[1] = 0;\n"
+"    lex->buf_pos[0] = lex->buf_pos[1] = 0;\n"
+"    lex->ahead = 0;\n"
+"    lex->replay = NULL;\n"
+"    lex->replay_len = lex->replay_off = lex->max_replay = 0;\n"
+"    lex->failed = 0;\n"
+"    lex->quiet = 0;\n"
+"    lex->prof_off = 0;\n"
 "    lex->buf_off = 0;\n"
-"    lex->read_len = 0;\n"
-"    lex->cur_line = 1;\n"
-"    lex->cur_chr = 1;\n"
+"    lex->lines = NULL;\n"
+"    lex->num_lines = lex->max_lines = 0;\n"
+"    lex->lines_off = 0;\n"
+"    lex->push_start = 0;\n"
+"    lex->push_state = 0;\n"
+"    lex->push_target = NULL;\n"
+"    lex->push_targ_len = 0;\n"
+"    lex->push_toks = NULL;\n"
+"    lex->max_push_toks = 0;\n"
+"    lex->str = NULL;\n"
+"    lex->max_str = 0;\n"
 "\n"
 "    lex->max_bytes = 32;\n"
 "    lex->num_bytes = 0;\n"
 "    lex->symtab = malloc(lex->max_bytes);\n"
 "    if(!lex->symtab) {\n"
 "        perror(\"malloc\");\n"
-"        goto exit;\n"
+"        free(lex);\n"
+"        return NULL;\n"
+"    }\n"
+"    if(lexer_engine_init(lex) < 0) {\n"
+"        lexer_engine_free(lex);\n"
+"        free(lex->symtab);\n"
+"        free(lex);\n"
+"        return NULL;\n"
+"    }\n"
+"    return lex;\n"
+"}\n"
+"\n"
+"// a regular file is mapped whole when map is set, other files and\n"
+"// pipes are read into buf\n"
+"static lexer_t* lexer_open(const char *filename, int map) {\n"
+"    struct stat st;\n"
+"    lexer_t *lex = lexer_alloc();\n"
+"    if(!lex)\n"
+"        return NULL;\n"
+"\n"
+"    lex->fd = open(filename, O_RDONLY);\n"
+"    if(lex->fd < 0) {\n"
+"        perror(\"open\");\n"
+"        lexer_free(lex);\n"
+"        return NULL;\n"
 "    }\n"
 "\n"
+"    if(map && fstat(lex->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {\n"
+"        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, lex->fd, 0);\n"
+"        if(data != MAP_FAILED) {\n"
+"            // hints are declared by glibc with _DEFAULT_SOURCE only\n"
+"#ifdef MADV_SEQUENTIAL\n"
+"            madvise(data, st.st_size, MADV_SEQUENTIAL);\n"
+"#endif\n"
+"#ifdef MADV_HUGEPAGE\n"
+"            madvise(data, st.st_size, MADV_HUGEPAGE);\n"
+"#endif\n"
+"            lex->data = data;\n"
+"            lex->data_len = st.st_size;\n"
+"            lex->mapped = 1;\n"
+"            close(lex->fd);\n"
+"            lex->fd = -1;\n"
+"        }\n"
+"    }\n"
 "    return lex;\n"
-"exit:\n"
-"    if(lex) {\n"
-"        if(lex->symtab) free(lex->symtab);\n"
-"        free(lex);\n"
+"}\n"
+"\n"
+"lexer_t* lexer_create(const char *filename) {\n"
+"    return lexer_open(filename, 0);\n"
+"}\n"
+"\n"
+"lexer_t* lexer_create_mmap(const char *filename) {\n"
+"    return lexer_open(filename, 1);\n"
+"}\n"
+"\n"
+"// lexemes point into data, which must outlive the lexer\n"
+"lexer_t* lexer_create_buffer(const char *data, size_t len) {\n"
+"    lexer_t *lex = lexer_alloc();\n"
+"    if(!lex)\n"
+"        return NULL;\n"
+"    lex->data = len ? data : \"\";\n"
+"    lex->data_len = len;\n"
+"    return lex;\n"
+"}\n"
+"\n"
+"// lines holds offsets after the newlines of input read so far, it's\n"
+"// built by memchr over each read buffer or fed piece, over mapped files\n"
+"// and buffers only when a position is asked for\n"
+"static int lexer_index(lexer_t *lex, const char *buf, size_t len) {\n"
+"#ifndef LEXER_NO_POS\n"
+"    const char *cur = buf, *end = buf + len, *nl;\n"
+"    while((nl = memchr(cur, '\\n', end - cur))) {\n"
+"        if(lex->num_lines == lex->max_lines) {\n"
+"            size_t new_max = lex->max_lines ? lex->max_lines << 1 : 256;\n"
+"            size_t *tmp = realloc(lex->lines, new_max*sizeof(size_t));\n"
+"            if(!tmp) {\n"
+"                perror(\"realloc\");\n"
+"                return 0;\n"
+"            }\n"
+"            lex->lines = tmp;\n"
+"            lex->max_lines = new_max;\n"
+"        }\n"
+"        lex->lines[lex->num_lines++] = lex->lines_off + (nl + 1 - buf);\n"
+"        cur = nl + 1;\n"
 "    }\n"
-"    if(fd >= 0) close(fd);\n"
-"    return NULL;\n"
+"#else\n"
+"    (void)buf;\n"
+"#endif\n"
+"    lex->lines_off += len;\n"
+"    return 1;\n"
 "}\n"
 "\n"
-"lexer_res_t lexer_next_tok(lexer_t *lex, lexeme_t *m) {\n"
-"    int cur_state = 0, next_state = -1;\n"
-"    int (*target)(lexeme_t*) = NULL;\n"
-"    int (*next_target)(lexeme_t*) = NULL;\n"
-"    size_t lexeme_len = 0;\n"
-"    size_t targ_off, targ_line, targ_chr;\n"
-"    int targ_buf;\n"
-"    char *buf = lex->buf + (lex->cur_buf*sizeof(lex->buf)/2);\n"
-"    unsigned char c = 0;\n"
-"    ssize_t read_len = 0;\n"
+"// line and column of the byte at offset off from the start of input.\n"
+"// With LEXER_NO_POS input is counted as one line.\n"
+"void lexer_pos(lexer_t *lex, size_t off, size_t *line, size_t *col) {\n"
+"    if(lex->data && off > lex->lines_off) {\n"
+"        size_t end = off < lex->data_len ? off : lex->data_len;\n"
+"        lexer_index(lex, lex->data + lex->lines_off, end - lex->lines_off);\n"
+"    }\n"
+"    size_t lo = 0, hi = lex->num_lines;\n"
+"    while(lo < hi) {\n"
+"        size_t mid = lo + (hi - lo)/2;\n"
+"        if(lex->lines[mid] <= off)\n"
+"            lo = mid + 1;\n"
+"        else\n"
+"            hi = mid;\n"
+"    }\n"
+"    *line = lo + 1;\n"
+"    *col = off - (lo ? lex->lines[lo-1] : 0) + 1;\n"
+"}\n"
+"\n"
+"static void lexer_error(lexer_t *lex, size_t off, char c) {\n"
+"    size_t line, col;\n"
+"    if(lex->quiet)\n"
+"        return;\n"
+"    lexer_pos(lex, off, &line, &col);\n"
+"    fprintf(stderr, \"%lu:%lu unexpected %c\\n\", line, col, c);\n"
+"}\n"
+"\n"
+"// moves to the other half of buf, it's read only if it doesn't already\n"
+"// hold the data following the current half\n"
+"static int lexer_refill(lexer_t *lex) {\n"
+"    int next = !lex->cur_buf;\n"
+"    if(!lex->ahead) {\n"
+"        ssize_t len = read(lex->fd, lex->buf + next*LEXER_HALF, LEXER_HALF);\n"
+"        if(len < 0) {\n"
+"            perror(\"read\");\n"
+"            return -1;\n"
+"        }\n"
+"        lex->buf_len[next] = len;\n"
+"        lex->buf_pos[next] = lex->buf_pos[lex->cur_buf] + lex->buf_len[lex->cur_buf];\n"
+"        if(!lexer_index(lex, lex->buf + next*LEXER_HALF, len))\n"
+"            return -1;\n"
+"    }\n"
+"    lex->ahead = 0;\n"
+"    lex->cur_buf = next;\n"
+"    lex->buf_off = 0;\n"
+"    return 0;\n"
+"}\n"
+"\n"
+"// bytes after the lexeme in symtab are scanned again from replay, when\n"
+"// the half which held them was read over\n"
+"static int lexer_replay(lexer_t *lex, size_t targ_len) {\n"
+"    size_t n = lex->num_bytes - targ_len;\n"
+"    if(n > lex->max_replay) {\n"
+"        size_t new_max = lex->max_replay ? lex->max_replay : 256;\n"
+"        while(n > new_max)\n"
+"            new_max <<= 1;\n"
+"        char *tmp = realloc(lex->replay, new_max);\n"
+"        if(!tmp) {\n"
+"            perror(\"realloc\");\n"
+"            return 0;\n"
+"        }\n"
+"        lex->replay = tmp;\n"
+"        lex->max_replay = new_max;\n"
+"    }\n"
+"    memcpy(lex->replay, lex->symtab + targ_len, n);\n"
+"    lex->replay_len = n;\n"
+"    lex->replay_off = 0;\n"
+"    return 1;\n"
+"}\n"
+"\n"
+"// offset from the start of input of byte off of replay, while it's\n"
+"// scanned, or of the current half\n"
+"static inline size_t lexer_offset(lexer_t *lex, size_t off) {\n"
+"    if(lex->replay_len)\n"
+"        return lex->buf_pos[lex->cur_buf] + lex->buf_off - lex->replay_len + off;\n"
+"    return lex->buf_pos[lex->cur_buf] + off;\n"
+"}\n"
+"\n"
+"// appends bytes of a lexeme which continues past the end of a run\n"
+"static inline int lexer_spill(lexer_t *lex, const char *str, size_t len) {\n"
+"    if(lex->num_bytes + len > lex->max_bytes) {\n"
+"        while(lex->num_bytes + len > lex->max_bytes)\n"
+"            lex->max_bytes <<= 1;\n"
+"        char *tmp = realloc(lex->symtab, lex->max_bytes);\n"
+"        if(!tmp) {\n"
+"            perror(\"realloc\");\n"
+"            return 0;\n"
+"        }\n"
+"        lex->symtab = tmp;\n"
+"    }\n"
+"    memcpy(lex->symtab + lex->num_bytes, str, len);\n"
+"    return 1;\n"
+"}\n"
+"\n"
+"// next lexeme and its offset from the start of input, lexer_cur must be set\n"
+"static inline lexer_res_t lexer_tok(lexer_t *lex, lexeme_t *m, size_t *pos) {\n"
+"    int cur_state = 0;\n"
+"    lexer_action_t target = NULL;\n"
+"    size_t targ_len = 0, targ_off = 0, tok_start, start, len, off;\n"
+"    int targ_buf = 0, targ_replay, refills, spilled;\n"
+"    const char *buf, *str;\n"
 "\n"
 "    for(;;) {\n"
-"        for(size_t i = lex->buf_off; i < lex->read_len; i++) {\n"
-"            c = buf[i];\n"
+"        // the automaton runs over whole buffers or the whole mapped file.\n"
+"        // Lexemes point into them, bytes are copied to symtab only when a\n"
+"        // lexeme continues into the other half of buf.\n"
+"        tok_start = lex->buf_off;\n"
+"        *pos = lex->buf_pos[lex->cur_buf] + tok_start;\n"
+"        spilled = targ_replay = refills = 0;\n"
 "\n"
-"            if(next_target) {\n"
-"                target = next_target;\n"
-"                targ_buf = lex->cur_buf;\n"
-"                targ_off = i;\n"
-"                targ_line = lex->cur_line;\n"
-"                targ_chr = lex->cur_chr;\n"
-"                next_target = NULL;\n"
-"            }\n"
+"        // the first run of a lexeme may be over replay\n"
+"        if(lex->replay_len) {\n"
+"            buf = lex->replay;\n"
+"            len = lex->replay_len;\n"
+"            start = tok_start = lex->replay_off;\n"
+"            *pos = lexer_offset(lex, start);\n"
+"            lexer_action_t run_target = NULL;\n"
+"            size_t run_off = 0;\n"
 "\n"
-"            next_state = states[cur_state*255 + c];\n"
+"            off = lexer_scan(lex, &cur_state, (const unsigned char*)buf, start, len, &run_target, &run_off);\n"
 "\n"
-"            if(lex->num_bytes == lex->max_bytes) {\n"
-"                lex->max_bytes <<= 1;\n"
-"                char *tmp = realloc(lex->symtab, lex->max_bytes);\n"
-"                if(!tmp) {\n"
-"                    perror(\"realloc\");\n"
+"            if(off == len) {\n"
+"                if(!lexer_spill(lex, buf + start, off-start))\n"
 "                    return LEX_ERROR;\n"
-"                }\n"
-"                lex->symtab = tmp;\n"
+"                spilled = 1;\n"
 "            }\n"
-"            lex->symtab[lex->num_bytes++] = next_state == 0 ? 0 : c;\n"
+"            if(run_target) {\n"
+"                target = run_target;\n"
+"                targ_replay = 1;\n"
+"                targ_off = run_off;\n"
+"                targ_len = run_off-start;\n"
+"            }\n"
+"            lex->num_bytes += off-start;\n"
+"            lex->replay_off = off;\n"
+"            // the half goes on after replay\n"
+"            if(off == len)\n"
+"                lex->replay_len = 0;\n"
+"        }\n"
 "\n"
-"            if(next_state == 0)\n"
-"                break;\n"
-"            next_target = targets[next_state];\n"
+"        while(!lex->replay_len) {\n"
+"            if(lex->data) {\n"
+"                buf = lex->data;\n"
+"                len = lex->data_len;\n"
+"            } else {\n"
+"                buf = lex->buf + lex->cur_buf*LEXER_HALF;\n"
+"                len = lex->buf_len[lex->cur_buf];\n"
+"            }\n"
+"            start = lex->buf_off;\n"
+"            lexer_action_t run_target = NULL;\n"
+"            size_t run_off = 0;\n"
+"\n"
+"            off = lexer_scan(lex, &cur_state, (const unsigned char*)buf, start, len, &run_target, &run_off);\n"
+"\n"
+"            if(spilled || (off == len && !lex->data)) {\n"
+"                if(!lexer_spill(lex, buf + start, off-start))\n"
+"                    return LEX_ERROR;\n"
+"                spilled = 1;\n"
+"            }\n"
 "\n"
-"            cur_state = next_state;\n"
-"            if(c == '\\n') {\n"
-"                lex->cur_line++;\n"
-"                lex->cur_chr = 0;\n"
+"            if(run_target) {\n"
+"                target = run_target;\n"
+"                targ_buf = lex->cur_buf;\n"
+"                targ_replay = 0;\n"
+"                targ_off = run_off;\n"
+"                targ_len = lex->num_bytes + (run_off-start);\n"
+"                refills = 0;\n"
 "            }\n"
-"            lex->cur_chr++;\n"
-"            lex->buf_off++;\n"
-"            lexeme_len++;\n"
+"            lex->num_bytes += off-start;\n"
+"            lex->buf_off = off;\n"
+"\n"
+"            if(off < len || lex->data)\n"
+"                break;\n"
+"            if(lexer_refill(lex) < 0)\n"
+"                return LEX_ERROR;\n"
+"            refills++;\n"
+"            if(lex->buf_len[lex->cur_buf] == 0)\n"
+"                break;\n"
 "        }\n"
 "\n"
-"        if(lex->buf_off == lex->read_len) {\n"
-"            lex->cur_buf = !lex->cur_buf;\n"
-"            buf = lex->buf + (lex->cur_buf*sizeof(lex->buf)/2);\n"
-"            read_len = read(lex->fd, buf, sizeof(lex->buf)/2);\n"
-"            if(read_len < 0) {\n"
-"                perror(\"read\");\n"
+"        // a lexeme which wasn't copied lies in the last run\n"
+"        str = spilled ? lex->symtab : buf + tok_start;\n"
+"\n"
+"        // dead state or end of file\n"
+"        if(!target) {\n"
+"            if(off < len) {\n"
+"                lexer_error(lex, lexer_offset(lex, off), buf[off]);\n"
 "                return LEX_ERROR;\n"
 "            }\n"
-"            lex->read_len = read_len;\n"
-"            lex->buf_off=0;\n"
+"            return LEX_EOF;\n"
 "        }\n"
 "\n"
-"        if(next_state == 0 || lex->read_len == 0) {\n"
-"            if(target) {\n"
-"                lex->num_bytes = 0;\n"
-"                m->str = lex->symtab;\n"
-"                m->str_len = lexeme_len-1;\n"
-"                int class = target(m);\n"
-"                if(class < 0) {\n"
-"                    return LEX_ERROR;\n"
-"                } else if(class == 0) {\n"
-"                    cur_state = 0;\n"
-"                    if(lex->read_len == 0)\n"
-"                        return LEX_EOF;\n"
-"                } else {\n"
-"                    m->class = class;\n"
-"                    lex->cur_buf = targ_buf;\n"
-"                    lex->buf_off = targ_off;\n"
-"                    lex->cur_line = targ_line;\n"
-"                    lex->cur_chr = targ_chr;\n"
-"                    return LEX_SUCCESS;\n"
-"                }\n"
-"                target = NULL;\n"
-"            } else if(next_state == 0) {\n"
-"                fprintf(stderr, \"%lu:%lu unexpected %c\\n\", lex->cur_line, lex->cur_chr, c);\n"
+"        // bytes after the lexeme are scanned again from the halves, or\n"
+"        // from replay if the half with the end of the lexeme was read over\n"
+"        if(targ_replay || refills > 1) {\n"
+"            if(lex->replay_len)\n"
+"                lex->replay_off = targ_off;\n"
+"            else if(!lexer_replay(lex, targ_len))\n"
 "                return LEX_ERROR;\n"
-"            } else {\n"
-"                return LEX_EOF;\n"
+"        } else {\n"
+"            if(targ_buf != lex->cur_buf) {\n"
+"                lex->cur_buf = targ_buf;\n"
+"                lex->ahead = 1;\n"
 "            }\n"
+"            lex->buf_off = targ_off;\n"
 "        }\n"
+"\n"
+"        m->str = (char*)str;\n"
+"        m->str_len = targ_len;\n"
+"        int class = target(m);\n"
+"        if(class < 0)\n"
+"            return LEX_ERROR;\n"
+"\n"
+"        lex->num_bytes = 0;\n"
+"        if(class > 0) {\n"
+"            m->class = class;\n"
+"            return LEX_SUCCESS;\n"
+"        }\n"
+"\n"
+"        cur_state = 0;\n"
+"        target = NULL;\n"
 "    }\n"
 "\n"
 "    return LEX_ERROR;\n"
 "}\n"
 "\n"
+"lexer_res_t lexer_next_tok(lexer_t *lex, lexeme_t *m) {\n"
+"    size_t pos;\n"
+"    lexer_cur = lex;\n"
+"    return lexer_tok(lex, m, &pos);\n"
+"}\n"
+"\n"
+"// lexer_tok is inlined into the loops of batches. An error is returned\n"
+"// after the lexemes which precede it, by the next call.\n"
+"ptrdiff_t lexer_next_toks(lexer_t *lex, lexeme_t *out, size_t cap) {\n"
+"    size_t n = 0, pos;\n"
+"    if(lex->failed)\n"
+"        return -1;\n"
+"    lexer_cur = lex;\n"
+"    while(n < cap) {\n"
+"        lexer_res_t res = lexer_tok(lex, out + n, &pos);\n"
+"        if(res == LEX_ERROR) {\n"
+"            lex->failed = 1;\n"
+"            return n ? (ptrdiff_t)n : -1;\n"
+"        }\n"
+"        if(res == LEX_EOF)\n"
+"            break;\n"
+"        n++;\n"
+"    }\n"
+"    return n;\n"
+"}\n"
+"\n"
+"// lengths of compact lexemes take 32 bits\n"
+"static int lexer_compact(lexer_t *lex, lexer_tok_t *t, size_t pos, lexeme_t *m) {\n"
+"    size_t line, col;\n"
+"    if(m->str_len > UINT_MAX) {\n"
+"        if(!lex->quiet) {\n"
+"            lexer_pos(lex, pos, &line, &col);\n"
+"            fprintf(stderr, \"%lu:%lu lexeme is too long\\n\", line, col);\n"
+"        }\n"
+"        return 0;\n"
+"    }\n"
+"    *t = (lexer_tok_t){ pos, m->str_len, m->class };\n"
+"    return 1;\n"
+"}\n"
+"\n"
+"ptrdiff_t lexer_next_toks_compact(lexer_t *lex, lexer_tok_t *out, size_t cap) {\n"
+"    size_t n = 0, pos;\n"
+"    lexeme_t m;\n"
+"    if(lex->failed)\n"
+"        return -1;\n"
+"    lexer_cur = lex;\n"
+"    while(n < cap) {\n"
+"        lexer_res_t res = lexer_tok(lex, &m, &pos);\n"
+"        if(res == LEX_EOF)\n"
+"            break;\n"
+"        if(res == LEX_ERROR || !lexer_compact(lex, &out[n], pos, &m)) {\n"
+"            lex->failed = 1;\n"
+"            return n ? (ptrdiff_t)n : -1;\n"
+"        }\n"
+"        n++;\n"
+"    }\n"
+"    return n;\n"
+"}\n"
+"\n"
+"// lexemes are only fed to it by lexer_feed\n"
+"lexer_t* lexer_create_push(void) {\n"
+"    return lexer_alloc();\n"
+"}\n"
+"\n"
+"static int lexer_reserve(lexer_t *lex, size_t num_bytes) {\n"
+"    if(num_bytes <= lex->max_bytes)\n"
+"        return 1;\n"
+"    while(num_bytes > lex->max_bytes)\n"
+"        lex->max_bytes <<= 1;\n"
+"    char *tmp = realloc(lex->symtab, lex->max_bytes);\n"
+"    if(!tmp) {\n"
+"        perror(\"realloc\");\n"
+"        return 0;\n"
+"    }\n"
+"    lex->symtab = tmp;\n"
+"    return 1;\n"
+"}\n"
+"\n"
+"// runs the action of a lexeme completed by lexer_feed, lexemes of\n"
+"// classes other than 0 are kept in push_toks\n"
+"static int lexer_feed_tok(lexer_t *lex, lexer_action_t target, const char *str, size_t len, size_t *n) {\n"
+"    if(*n == lex->max_push_toks) {\n"
+"        size_t new_max = *n ? *n << 1 : 64;\n"
+"        lexeme_t *tmp = realloc(lex->push_toks, new_max*sizeof(lexeme_t));\n"
+"        if(!tmp) {\n"
+"            perror(\"realloc\");\n"
+"            return 0;\n"
+"        }\n"
+"        lex->push_toks = tmp;\n"
+"        lex->max_push_toks = new_max;\n"
+"    }\n"
+"    lexeme_t *m = lex->push_toks + *n;\n"
+"    m->str = (char*)str;\n"
+"    m->str_len = len;\n"
+"    int class = target(m);\n"
+"    if(class < 0)\n"
+"        return 0;\n"
+"    if(class > 0) {\n"
+"        m->class = class;\n"
+"        (*n)++;\n"
+"    }\n"
+"    return 1;\n"
+"}\n"
+"\n"
+"// the automaton stops at the end of buf in the middle of a lexeme and\n"
+"// goes on from there in the next call. Only bytes of such lexemes are\n"
+"// copied to symtab, they are kept there until the next call, so lexemes\n"
+"// point either into buf or into symtab. Errors are returned like by\n"
+"// lexer_next_toks.\n"
+"ptrdiff_t lexer_feed(lexer_t *lex, const char *buf, size_t len, lexeme_t **toks) {\n"
+"    const unsigned char *in = (const unsigned char*)buf;\n"
+"    size_t n = 0, pos = 0, start = 0, used, scanned, off, toff;\n"
+"    lexer_action_t t;\n"
+"\n"
+"    *toks = lex->push_toks;\n"
+"    if(lex->failed)\n"
+"        return -1;\n"
+"    lexer_cur = lex;\n"
+"    size_t feed_off = lex->lines_off, sym_off = feed_off - lex->num_bytes;\n"
+"    if(buf && !lexer_index(lex, buf, len))\n"
+"        goto error;\n"
+"\n"
+"    // room for all of buf, symtab isn't moved while lexemes point into it\n"
+"    if(lex->num_bytes > 0) {\n"
+"        memmove(lex->symtab, lex->symtab + lex->push_start, lex->num_bytes);\n"
+"        if(!lexer_reserve(lex, lex->num_bytes + len))\n"
+"            goto error;\n"
+"    }\n"
+"    used = scanned = lex->num_bytes;\n"
+"\n"
+"    // the lexeme in symtab[start..used) comes before buf, bytes after\n"
+"    // scanned weren't scanned since the last lexeme ended\n"
+"    while(lex->num_bytes > 0) {\n"
+"        size_t p = lex->num_bytes;\n"
+"        const char *str = lex->symtab + start;\n"
+"        off = p;\n"
+"        if(scanned < p) {\n"
+"            t = NULL;\n"
+"            scanned = lexer_scan(lex, &lex->push_state, (const unsigned char*)str, scanned, p, &t, &toff);\n"
+"            if(t) {\n"
+"                lex->push_target = t;\n"
+"                lex->push_targ_len = toff;\n"
+"            }\n"
+"        }\n"
+"        if(scanned == p) {\n"
+"            t = NULL;\n"
+"            off = lexer_scan(lex, &lex->push_state, in, 0, len, &t, &toff);\n"
+"            if(t) {\n"
+"                lex->push_target = t;\n"
+"                lex->push_targ_len = p + toff;\n"
+"            }\n"
+"            if(off == len && buf) {\n"
+"                memcpy(lex->symtab + used, buf, len);\n"
+"                lex->num_bytes += len;\n"
+"                lex->push_start = start;\n"
+"                goto exit;\n"
+"            }\n"
+"        }\n"
+"\n"
+"        // dead state or end of input\n"
+"        if(!lex->push_target) {\n"
+"            if(scanned < p) {\n"
+"                lexer_error(lex, sym_off + start + scanned, str[scanned]);\n"
+"                goto error;\n"
+"            }\n"
+"            if(off < len) {\n"
+"                lexer_error(lex, feed_off + off, buf[off]);\n"
+"                goto error;\n"
+"            }\n"
+"            lex->num_bytes = 0;\n"
+"            break;\n"
+"        }\n"
+"\n"
+"        size_t targ_len = lex->push_targ_len;\n"
+"        if(targ_len > p) {\n"
+"            memcpy(lex->symtab + used, buf, targ_len - p);\n"
+"            used += targ_len - p;\n"
+"        }\n"
+"        if(!lexer_feed_tok(lex, lex->push_target, str, targ_len, &n))\n"
+"            goto error;\n"
+"        if(targ_len >= p) {\n"
+"            pos = targ_len - p;\n"
+"            lex->num_bytes = 0;\n"
+"        } else {\n"
+"            start += targ_len;\n"
+"            lex->num_bytes = p - targ_len;\n"
+"        }\n"
+"        scanned = 0;\n"
+"        lex->push_state = 0;\n"
+"        lex->push_target = NULL;\n"
+"    }\n"
+"\n"
+"    while(pos < len) {\n"
+"        int state = 0;\n"
+"        t = NULL;\n"
+"        off = lexer_scan(lex, &state, in, pos, len, &t, &toff);\n"
+"        if(off == len) {\n"
+"            if(!lexer_reserve(lex, used + len - pos))\n"
+"                goto error;\n"
+"            memcpy(lex->symtab + used, buf + pos, len - pos);\n"
+"            lex->push_start = used;\n"
+"            lex->num_bytes = len - pos;\n"
+"            lex->push_state = state;\n"
+"            lex->push_target = t;\n"
+"            lex->push_targ_len = t ? toff - pos : 0;\n"
+"            break;\n"
+"        }\n"
+"        if(!t) {\n"
+"            lexer_error(lex, feed_off + off, buf[off]);\n"
+"            goto error;\n"
+"        }\n"
+"        if(!lexer_feed_tok(lex, t, buf + pos, toff - pos, &n))\n"
+"            goto error;\n"
+"        pos = toff;\n"
+"    }\n"
+"\n"
+"exit:\n"
+"    *toks = lex->push_toks;\n"
+"    return n;\n"
+"error:\n"
+"    lex->failed = 1;\n"
+"    *toks = lex->push_toks;\n"
+"    return n ? (ptrdiff_t)n : -1;\n"
+"}\n"
+"\n"
 "void lexer_free(lexer_t *lex) {\n"
-"    close(lex->fd);\n"
+"    if(lex->fd >= 0)\n"
+"        close(lex->fd);\n"
+"    if(lex->mapped)\n"
+"        munmap((void*)lex->data, lex->data_len);\n"
 "    free(lex->symtab);\n"
+"    if(lex->lines) free(lex->lines);\n"
+"    if(lex->replay) free(lex->replay);\n"
+"    if(lex->push_toks) free(lex->push_toks);\n"
+"    if(lex->str) free(lex->str);\n"
+"    lexer_engine_free(lex);\n"
 "    free(lex);\n"
+"}\n"
+"\n"
+"// chunk of lexer_lex_parallel, which a thread lexes from start as if a\n"
+"// lexeme started there\n"
+"typedef struct {\n"
+"    const char    *data;\n"
+"    size_t        len, start, end;\n"
+"    lexer_chunk_t *chunk;\n"
+"    size_t        max_toks;\n"
+"    // start of the first lexeme at or after end, if the chunk didn't fail\n"
+"    size_t        next;\n"
+"    int           failed;\n"
+"} lexer_par_t;\n"
+"\n"
+"static int lexer_chunk_push(lexer_chunk_t *c, size_t *max_toks, lexer_tok_t tok) {\n"
+"    if(c->num_toks == *max_toks) {\n"
+"        size_t new_max = *max_toks ? *max_toks << 1 : 1024;\n"
+"        lexer_tok_t *tmp = realloc(c->toks, new_max*sizeof(lexer_tok_t));\n"
+"        if(!tmp) {\n"
+"            perror(\"realloc\");\n"
+"            return 0;\n"
+"        }\n"
+"        c->toks = tmp;\n"
+"        *max_toks = new_max;\n"
+"    }\n"
+"    c->toks[c->num_toks++] = tok;\n"
+"    return 1;\n"
+"}\n"
+"\n"
+"static void* lexer_par_run(void *arg) {\n"
+"    lexer_par_t *p = arg;\n"
+"    lexer_tok_t tok;\n"
+"    lexeme_t m;\n"
+"    size_t pos;\n"
+"\n"
+"    p->failed = 1;\n"
+"    lexer_t *lex = lexer_create_buffer(p->data + p->start, p->len - p->start);\n"
+"    if(!lex)\n"
+"        return NULL;\n"
+"    // a wrong guess of the start may run into errors which aren't there\n"
+"    lex->quiet = 1;\n"
+"    lex->prof_off = 1;\n"
+"    lexer_cur = lex;\n"
+"    for(;;) {\n"
+"        lexer_res_t res = lexer_tok(lex, &m, &pos);\n"
+"        if(res == LEX_ERROR)\n"
+"            goto exit;\n"
+"        if(res == LEX_EOF) {\n"
+"            p->next = p->len;\n"
+"            break;\n"
+"        }\n"
+"        pos += p->start;\n"
+"        if(pos >= p->end) {\n"
+"            p->next = pos;\n"
+"            break;\n"
+"        }\n"
+"        if(!lexer_compact(lex, &tok, pos, &m) || !lexer_chunk_push(p->chunk, &p->max_toks, tok))\n"
+"            goto exit;\n"
+"    }\n"
+"    p->failed = 0;\n"
+"exit:\n"
+"    lexer_free(lex);\n"
+"    return NULL;\n"
+"}\n"
+"\n"
+"// lexes the true lexemes of chunk p from next, until one of them starts\n"
+"// where a lexeme of the chunk does, then the rest of the chunk is right.\n"
+"// next becomes the start of the first lexeme after the chunk.\n"
+"static lexer_res_t lexer_par_fix(lexer_t *fix, lexer_par_t *p, size_t *next) {\n"
+"    lexer_chunk_t res = { NULL, 0 };\n"
+"    size_t max_toks = 0, j = 0, pos, from = *next;\n"
+"    lexer_tok_t tok;\n"
+"    lexeme_t m;\n"
+"\n"
+"    fix->buf_off = from;\n"
+"    for(;;) {\n"
+"        lexer_res_t r = lexer_tok(fix, &m, &pos);\n"
+"        if(r == LEX_ERROR)\n"
+"            goto error;\n"
+"        if(r == LEX_EOF || pos >= p->end) {\n"
+"            *next = r == LEX_EOF ? p->len : pos;\n"
+"            break;\n"
+"        }\n"
+"        while(!p->failed && j < p->chunk->num_toks && p->chunk->toks[j].off < pos)\n"
+"            j++;\n"
+"        if(!p->failed && j < p->chunk->num_toks && p->chunk->toks[j].off == pos) {\n"
+"            for(; j < p->chunk->num_toks; j++) {\n"
+"                if(!lexer_chunk_push(&res, &max_toks, p->chunk->toks[j]))\n"
+"                    goto fail;\n"
+"            }\n"
+"            *next = p->next;\n"
+"            break;\n"
+"        }\n"
+"        if(!lexer_compact(fix, &tok, pos, &m)) {\n"
+"            // lexemes of fix are true ones, so it's reported\n"
+"            fix->quiet = 0;\n"
+"            lexer_compact(fix, &tok, pos, &m);\n"
+"            goto fail;\n"
+"        }\n"
+"        if(!lexer_chunk_push(&res, &max_toks, tok))\n"
+"            goto fail;\n"
+"    }\n"
+"    free(p->chunk->toks);\n"
+"    *p->chunk = res;\n"
+"    return LEX_SUCCESS;\n"
+"\n"
+"error:\n"
+"    // the error is lexed again to report it\n"
+"    fix->quiet = 0;\n"
+"    fix->buf_off = from;\n"
+"    fix->num_bytes = 0;\n"
+"    while(lexer_tok(fix, &m, &pos) == LEX_SUCCESS)\n"
+"        ;\n"
+"fail:\n"
+"    free(res.toks);\n"
+"    return LEX_ERROR;\n"
+"}\n"
+"\n"
+"// chunks start after a newline, where a lexeme most likely starts too.\n"
+"// Every chunk is lexed by its own thread, then their lexemes are checked\n"
+"// in order against the end of the previous chunk and lexed again up to\n"
+"// the first common lexeme if the guess was wrong.\n"
+"lexer_res_t lexer_lex_parallel(const char *data, size_t len, lexer_chunk_t *chunks, size_t num_chunks) {\n"
+"    lexer_res_t res = LEX_ERROR;\n"
+"    lexer_par_t *pars = NULL;\n"
+"    pthread_t *threads = NULL;\n"
+"    int *started = NULL;\n"
+"    lexer_t *fix = NULL;\n"
+"    size_t next = 0;\n"
+"\n"
+"    // there is nowhere to store lexemes\n"
+"    if(num_chunks == 0)\n"
+"        return LEX_ERROR;\n"
+"    for(size_t k = 0; k < num_chunks; k++) {\n"
+"        chunks[k].toks = NULL;\n"
+"        chunks[k].num_toks = 0;\n"
+"    }\n"
+"    pars = malloc(num_chunks*sizeof(lexer_par_t));\n"
+"    threads = malloc(num_chunks*sizeof(pthread_t));\n"
+"    started = calloc(num_chunks, sizeof(int));\n"
+"    if(!pars || !threads || !started) {\n"
+"        perror(\"malloc\");\n"
+"        goto exit;\n"
+"    }\n"
+"\n"
+"    for(size_t k = 0; k < num_chunks; k++) {\n"
+"        size_t start = k ? pars[k-1].end : 0, end = len;\n"
+"        if(k+1 < num_chunks) {\n"
+"            end = len / num_chunks * (k+1);\n"
+"            const char *nl = end < len ? memchr(data + end, '\\n', len - end) : NULL;\n"
+"            end = nl ? (size_t)(nl - data) + 1 : len;\n"
+"            if(end < start)\n"
+"                end = start;\n"
+"        }\n"
+"        pars[k] = (lexer_par_t){ data, len, start, end, &chunks[k], 0, len, 1 };\n"
+"    }\n"
+"    for(size_t k = 1; k < num_chunks; k++)\n"
+"        started[k] = pthread_create(&threads[k], NULL, lexer_par_run, &pars[k]) == 0;\n"
+"    lexer_par_run(&pars[0]);\n"
+"    for(size_t k = 1; k < num_chunks; k++) {\n"
+"        if(started[k])\n"
+"            pthread_join(threads[k], NULL);\n"
+"        else\n"
+"            lexer_par_run(&pars[k]);\n"
+"    }\n"
+"\n"
+"    fix = lexer_create_buffer(data, len);\n"
+"    if(!fix)\n"
+"        goto exit;\n"
+"    fix->quiet = 1;\n"
+"    fix->prof_off = 1;\n"
+"    lexer_cur = fix;\n"
+"    for(size_t k = 0; k < num_chunks; k++) {\n"
+"        lexer_par_t *p = &pars[k];\n"
+"        // a lexeme of previous chunks covers this one\n"
+"        if(next >= p->end) {\n"
+"            chunks[k].num_toks = 0;\n"
+"            continue;\n"
+"        }\n"
+"        if(!p->failed && (k == 0 || (chunks[k].num_toks > 0 && chunks[k].toks[0].off == next) ||\n"
+"                          (chunks[k].num_toks == 0 && p->next == next))) {\n"
+"            next = p->next;\n"
+"            continue;\n"
+"        }\n"
+"        if(lexer_par_fix(fix, p, &next) != LEX_SUCCESS)\n"
+"            goto exit;\n"
+"    }\n"
+"    res = LEX_SUCCESS;\n"
+"\n"
+"exit:\n"
+"    if(res != LEX_SUCCESS) {\n"
+"        for(size_t k = 0; k < num_chunks; k++) {\n"
+"            free(chunks[k].toks);\n"
+"            chunks[k].toks = NULL;\n"
+"            chunks[k].num_toks = 0;\n"
+"        }\n"
+"    }\n"
+"    if(fix) lexer_free(fix);\n"
+"    if(pars) free(pars);\n"
+"    if(threads) free(threads);\n"
+"    if(started) free(started);\n"
+"    return res;\n"
+"}\n";
+
+static char lexer_c_scan[] =
+"\n"
+"// runs the automaton over buf[off..len) from *state and returns where it\n"
+"// stopped: len or the first byte without a transition. The last accepting\n"
+"// position and its target are stored in *targ_off and *target.\n"
+"static inline size_t lexer_scan(lexer_t *lex, int *state, const unsigned char *buf, size_t off, size_t len, lexer_action_t *target, size_t *targ_off) {\n"
+"    int cur = *state, next;\n"
+"    lexer_action_t t;\n"
+"\n"
+"    while(off < len) {\n"
+"        next = lexer_step(lex, cur, buf[off]);\n"
+"        if(next == 0)\n"
+"            break;\n"
+"        off++;\n"
+"#ifdef LEXER_LOOPS\n"
+"        // a taken self loop skips the rest of its bytes at once\n"
+"        if(next == cur && loop_ids[cur])\n"
+"            off = LEXER_SKIP(&lexer_loops[loop_ids[cur]-1], buf, off, len);\n"
+"#endif\n"
+"        cur = next;\n"
+"        if((t = lexer_target(lex, cur))) {\n"
+"            *target = t;\n"
+"            *targ_off = off;\n"
+"        }\n"
+"    }\n"
+"    *state = cur;\n"
+"    return off;\n"
+"}\n";
+
+// Skipping of self loops of DFA states, LEXER_LOOP_RANGES is generated
+// with the loops.
+static char lexer_c_loop[] =
+"\n"
+"// bytes which keep a DFA state in itself, lo[i] <= c <= lo[i]+span[i].\n"
+"// Unused ranges repeat the first one.\n"
+"typedef struct {\n"
+"    unsigned char lo[LEXER_LOOP_RANGES], span[LEXER_LOOP_RANGES];\n"
+"} lexer_loop_t;\n"
+"\n"
+"static inline int lexer_loop_has(const lexer_loop_t *l, unsigned char c) {\n"
+"    for(int i = 0; i < LEXER_LOOP_RANGES; i++) {\n"
+"        if((unsigned char)(c - l->lo[i]) <= l->span[i])\n"
+"            return 1;\n"
+"    }\n"
+"    return 0;\n"
+"}\n"
+"\n"
+"#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(LEXER_NO_SIMD)\n"
+"#include <immintrin.h>\n"
+"\n"
+"// c is in a range if min(c-lo, span) == c-lo as unsigned bytes\n"
+"__attribute__((target(\"sse2\")))\n"
+"static inline size_t lexer_skip_sse2(const lexer_loop_t *l, const unsigned char *buf, size_t off, size_t len) {\n"
+"    __m128i lo[LEXER_LOOP_RANGES], span[LEXER_LOOP_RANGES];\n"
+"    for(int i = 0; i < LEXER_LOOP_RANGES; i++) {\n"
+"        lo[i] = _mm_set1_epi8(l->lo[i]);\n"
+"        span[i] = _mm_set1_epi8(l->span[i]);\n"
+"    }\n"
+"    for(; off + 16 <= len; off += 16) {\n"
+"        __m128i v = _mm_loadu_si128((const __m128i*)(buf + off)), in = _mm_setzero_si128();\n"
+"        for(int i = 0; i < LEXER_LOOP_RANGES; i++) {\n"
+"            __m128i d = _mm_sub_epi8(v, lo[i]);\n"
+"            in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(d, span[i]), d));\n"
+"        }\n"
+"        unsigned int out = ~_mm_movemask_epi8(in) & 0xffff;\n"
+"        if(out)\n"
+"            return off + __builtin_ctz(out);\n"
+"    }\n"
+"    return off;\n"
+"}\n"
+"\n"
+"__attribute__((target(\"avx2\")))\n"
+"static inline size_t lexer_skip_avx2(const lexer_loop_t *l, const unsigned char *buf, size_t off, size_t len) {\n"
+"    __m256i lo[LEXER_LOOP_RANGES], span[LEXER_LOOP_RANGES];\n"
+"    for(int i = 0; i < LEXER_LOOP_RANGES; i++) {\n"
+"        lo[i] = _mm256_set1_epi8(l->lo[i]);\n"
+"        span[i] = _mm256_set1_epi8(l->span[i]);\n"
+"    }\n"
+"    for(; off + 32 <= len; off += 32) {\n"
+"        __m256i v = _mm256_loadu_si256((const __m256i*)(buf + off)), in = _mm256_setzero_si256();\n"
+"        for(int i = 0; i < LEXER_LOOP_RANGES; i++) {\n"
+"            __m256i d = _mm256_sub_epi8(v, lo[i]);\n"
+"            in = _mm256_or_si256(in, _mm256_cmpeq_epi8(_mm256_min_epu8(d, span[i]), d));\n"
+"        }\n"
+"        unsigned int out = ~(unsigned int)_mm256_movemask_epi8(in);\n"
+"        if(out)\n"
+"            return off + __builtin_ctz(out);\n"
+"    }\n"
+"    return off;\n"
+"}\n"
+"\n"
+"// skips the bytes of a loop from off, 32 or 16 at a time while they fit\n"
+"static inline size_t lexer_skip(const lexer_loop_t *l, const unsigned char *buf, size_t off, size_t len) {\n"
+"    if(__builtin_cpu_supports(\"avx2\"))\n"
+"        off = lexer_skip_avx2(l, buf, off, len);\n"
+"    else\n"
+"        off = lexer_skip_sse2(l, buf, off, len);\n"
+"    while(off < len && lexer_loop_has(l, buf[off]))\n"
+"        off++;\n"
+"    return off;\n"
+"}\n"
+"#else\n"
+"static inline size_t lexer_skip(const lexer_loop_t *l, const unsigned char *buf, size_t off, size_t len) {\n"
+"    while(off < len && lexer_loop_has(l, buf[off]))\n"
+"        off++;\n"
+"    return off;\n"
+"}\n"
+"#endif\n"
+"\n"
+"// a profiling build counts every byte, so loops aren't skipped\n"
+"#ifdef LEXER_PROFILE\n"
+"#define LEXER_SKIP(l, buf, off, len) ((void)(l), (off))\n"
+"#else\n"
+"#define LEXER_SKIP(l, buf, off, len) lexer_skip(l, buf, off, len)\n"
+"#endif\n";
+
+static char lexer_c_kw[] =
+"\n"
+"// same hash as the generator uses for keyword tables\n"
+"static inline unsigned int lexer_kw_hash(const char *str, size_t len, unsigned int seed) {\n"
+"    unsigned int hash = 0x811c9dc5 ^ seed;\n"
+"    for(size_t i = 0; i < len; i++) {\n"
+"        hash ^= (unsigned char)str[i];\n"
+"        hash *= 0x01000193;\n"
+"    }\n"
+"    hash ^= hash >> 16;\n"
+"    hash *= 0x85ebca6b;\n"
+"    hash ^= hash >> 13;\n"
+"    hash *= 0xc2b2ae35;\n"
+"    hash ^= hash >> 16;\n"
+"    return hash;\n"
 "}\n";
+
+// Profiling of DFA engines, LEXER_NUM_STATES, LEXER_PROF_HASH and
+// LEXER_PROF_ID are generated with the tables.
+static char lexer_c_prof[] =
+"#ifdef LEXER_PROFILE\n"
+"#ifndef LEXER_PROFILE_FILE\n"
+"#define LEXER_PROFILE_FILE \"lexer.prof\"\n"
+"#endif\n"
+"\n"
+"// counts of all lexers of the process, lexer_free writes them for trans -P\n"
+"static unsigned long long prof_visits[LEXER_NUM_STATES];\n"
+"static unsigned long long prof_edges[LEXER_NUM_STATES][LEXER_NUM_CLASSES];\n"
+"\n"
+"// lexers of lexer_lex_parallel set prof_off, they would race on the\n"
+"// counts and count chunks lexed again twice\n"
+"#define LEXER_PROF_STEP(state, c) (lex->prof_off ? 0 : (prof_visits[state]++, prof_edges[state][classes[c]]++))\n"
+"\n"
+"static void lexer_prof_write(void) {\n"
+"    FILE *fd = fopen(LEXER_PROFILE_FILE, \"w\");\n"
+"    if(!fd) {\n"
+"        perror(LEXER_PROFILE_FILE);\n"
+"        return;\n"
+"    }\n"
+"    fprintf(fd, \"trans profile %d %d %s\\n\", LEXER_NUM_STATES, LEXER_NUM_CLASSES, LEXER_PROF_HASH);\n"
+"    for(int s = 0; s < LEXER_NUM_STATES; s++) {\n"
+"        if(!prof_visits[s])\n"
+"            continue;\n"
+"        fprintf(fd, \"state %u %llu\\n\", LEXER_PROF_ID(s), prof_visits[s]);\n"
+"        for(int c = 0; c < LEXER_NUM_CLASSES; c++) {\n"
+"            if(prof_edges[s][c])\n"
+"                fprintf(fd, \"edge %u %d %llu\\n\", LEXER_PROF_ID(s), c, prof_edges[s][c]);\n"
+"        }\n"
+"    }\n"
+"    fclose(fd);\n"
+"}\n"
+"#else\n"
+"#define LEXER_PROF_STEP(state, c)\n"
+"#endif\n";
+
+// Engines provide lexer_engine_init, lexer_engine_free and lexer_scan used
+// by lexer_c, most of them by lexer_step and lexer_target with lexer_c_scan.
+static char lexer_c_table[] =
+"static inline int lexer_engine_init(lexer_t *lex) {\n"
+"    return 0;\n"
+"}\n"
+"\n"
+"static inline void lexer_engine_free(lexer_t *lex) {\n"
+"#ifdef LEXER_PROFILE\n"
+"    if(!lex->prof_off)\n"
+"        lexer_prof_write();\n"
+"#endif\n"
+"}\n"
+"\n"
+"static inline int lexer_step(lexer_t *lex, int state, unsigned char c) {\n"
+"    LEXER_PROF_STEP(state, c);\n"
+"    return states[state*LEXER_NUM_CLASSES + classes[c]];\n"
+"}\n"
+"\n"
+"static inline lexer_action_t lexer_target(lexer_t *lex, int state) {\n"
+"    return targets[state];\n"
+"}\n"
+"\n";
+
+static char lexer_c_comb[] =
+"static inline int lexer_engine_init(lexer_t *lex) {\n"
+"    return 0;\n"
+"}\n"
+"\n"
+"static inline void lexer_engine_free(lexer_t *lex) {\n"
+"#ifdef LEXER_PROFILE\n"
+"    if(!lex->prof_off)\n"
+"        lexer_prof_write();\n"
+"#endif\n"
+"}\n"
+"\n"
+"// a state's own row first, then the row of its default state\n"
+"static inline int lexer_step(lexer_t *lex, int state, unsigned char c) {\n"
+"    unsigned int cls = classes[c];\n"
+"    LEXER_PROF_STEP(state, c);\n"
+"    if(comb_check[comb_base[state] + cls] != state) {\n"
+"        state = comb_default[state];\n"
+"        if(!state || comb_check[comb_base[state] + cls] != state)\n"
+"            return 0;\n"
+"    }\n"
+"    return comb_next[comb_base[state] + cls];\n"
+"}\n"
+"\n"
+"static inline lexer_action_t lexer_target(lexer_t *lex, int state) {\n"
+"    return targets[state];\n"
+"}\n"
+"\n";
+
+static char lexer_c_direct[] =
+"static inline int lexer_engine_init(lexer_t *lex) {\n"
+"    return 0;\n"
+"}\n"
+"\n"
+"static inline void lexer_engine_free(lexer_t *lex) {\n"
+"#ifdef LEXER_PROFILE\n"
+"    if(!lex->prof_off)\n"
+"        lexer_prof_write();\n"
+"#endif\n"
+"}\n";
+
+static char lexer_h_mmap[] =
+"    struct lexer_mmap_s *dfa;\n";
+
+// the mmap engine reads its DFA from a file written by trans
+static char lexer_h_mmap_api[] =
+"\n"
+"// file with the DFA, LEXER_DFA_FILE by default\n"
+"void lexer_set_dfa_file(const char *filename);\n";
+
+static char lexer_c_mmap[] =
+"static const char *lexer_dfa_file = LEXER_DFA_FILE;\n"
+"\n"
+"void lexer_set_dfa_file(const char *filename) {\n"
+"    lexer_dfa_file = filename;\n"
+"}\n"
+"\n"
+"// dfa_file_hdr_t of trans\n"
+"typedef struct {\n"
+"    char     magic[8];\n"
+"    uint32_t version;\n"
+"    uint32_t byte_order;\n"
+"    uint32_t num_states;\n"
+"    uint32_t num_classes;\n"
+"    uint32_t num_rules;\n"
+"    uint32_t classes_off;\n"
+"    uint32_t states_off;\n"
+"    uint32_t targets_off;\n"
+"    uint64_t size;\n"
+"} lexer_dfa_hdr_t;\n"
+"\n"
+"struct lexer_mmap_s {\n"
+"    void                 *map;\n"
+"    size_t               map_len;\n"
+"    const unsigned char  *classes;\n"
+"    const uint16_t       *states;\n"
+"    size_t               num_classes;\n"
+"    lexer_action_t       *targets;\n"
+"};\n"
+"\n"
+"// the file is mapped read-only, so processes using one file share its\n"
+"// pages. Transitions are used as they are, other fields are checked.\n"
+"static int lexer_engine_init(lexer_t *lex) {\n"
+"    const lexer_dfa_hdr_t *hdr;\n"
+"    const uint32_t *targets;\n"
+"    struct stat st;\n"
+"    int fd;\n"
+"\n"
+"    struct lexer_mmap_s *m = calloc(1, sizeof(struct lexer_mmap_s));\n"
+"    lex->dfa = m;\n"
+"    if(!m) {\n"
+"        perror(\"calloc\");\n"
+"        return -1;\n"
+"    }\n"
+"\n"
+"    fd = open(lexer_dfa_file, O_RDONLY);\n"
+"    if(fd < 0) {\n"
+"        perror(lexer_dfa_file);\n"
+"        return -1;\n"
+"    }\n"
+"    if(fstat(fd, &st) < 0) {\n"
+"        perror(\"fstat\");\n"
+"        close(fd);\n"
+"        return -1;\n"
+"    }\n"
+"    if(st.st_size < (off_t)sizeof(lexer_dfa_hdr_t))\n"
+"        goto bad;\n"
+"    m->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);\n"
+"    if(m->map == MAP_FAILED) {\n"
+"        m->map = NULL;\n"
+"        perror(\"mmap\");\n"
+"        close(fd);\n"
+"        return -1;\n"
+"    }\n"
+"    m->map_len = st.st_size;\n"
+"    close(fd);\n"
+"\n"
+"    hdr = m->map;\n"
+"    if(memcmp(hdr->magic, \"TRANSDFA\", 8) || hdr->version != LEXER_DFA_VERSION ||\n"
+"       hdr->byte_order != 0x01020304 || hdr->size != (uint64_t)st.st_size ||\n"
+"       hdr->num_rules != LEXER_NUM_RULES || hdr->num_states == 0 ||\n"
+"       hdr->num_classes == 0 || hdr->num_classes > 256 ||\n"
+"       hdr->classes_off % 64 || hdr->states_off % 64 || hdr->targets_off % 64 ||\n"
+"       hdr->classes_off + 256ULL > hdr->size ||\n"
+"       hdr->states_off + 2ULL*hdr->num_states*hdr->num_classes > hdr->size ||\n"
+"       hdr->targets_off + 4ULL*hdr->num_states > hdr->size)\n"
+"        goto bad;\n"
+"\n"
+"    m->classes = (const unsigned char*)m->map + hdr->classes_off;\n"
+"    m->states = (const uint16_t*)((const char*)m->map + hdr->states_off);\n"
+"    m->num_classes = hdr->num_classes;\n"
+"    for(int c = 0; c < 256; c++) {\n"
+"        if(m->classes[c] >= hdr->num_classes)\n"
+"            goto bad;\n"
+"    }\n"
+"    // transitions are followed unchecked by lexer_scan\n"
+"    for(size_t i = 0; i < (size_t)hdr->num_states*hdr->num_classes; i++) {\n"
+"        if(m->states[i] >= hdr->num_states)\n"
+"            goto bad;\n"
+"    }\n"
+"\n"
+"    // actions are looked up once, not on every accepting state\n"
+"    targets = (const uint32_t*)((const char*)m->map + hdr->targets_off);\n"
+"    m->targets = malloc(hdr->num_states*sizeof(lexer_action_t));\n"
+"    if(!m->targets) {\n"
+"        perror(\"malloc\");\n"
+"        return -1;\n"
+"    }\n"
+"    for(uint32_t s = 0; s < hdr->num_states; s++) {\n"
+"        if(targets[s] > LEXER_NUM_RULES)\n"
+"            goto bad;\n"
+"        m->targets[s] = targets[s] ? rule_actions[targets[s]-1] : NULL;\n"
+"    }\n"
+"    return 0;\n"
+"bad:\n"
+"    fprintf(stderr, \"%s isn't a DFA of this lexer\\n\", lexer_dfa_file);\n"
+"    return -1;\n"
+"}\n"
+"\n"
+"static void lexer_engine_free(lexer_t *lex) {\n"
+"    struct lexer_mmap_s *m = lex->dfa;\n"
+"    if(!m)\n"
+"        return;\n"
+"    if(m->map) munmap(m->map, m->map_len);\n"
+"    if(m->targets) free(m->targets);\n"
+"    free(m);\n"
+"}\n"
+"\n"
+"// lexer_c_scan with the tables in locals\n"
+"static inline size_t lexer_scan(lexer_t *lex, int *state, const unsigned char *buf, size_t off, size_t len, lexer_action_t *target, size_t *targ_off) {\n"
+"    const struct lexer_mmap_s *m = lex->dfa;\n"
+"    const unsigned char *classes = m->classes;\n"
+"    const uint16_t *states = m->states;\n"
+"    lexer_action_t *targets = m->targets;\n"
+"    size_t num_classes = m->num_classes;\n"
+"    int cur = *state, next;\n"
+"\n"
+"    while(off < len) {\n"
+"        next = states[cur*num_classes + classes[buf[off]]];\n"
+"        if(next == 0)\n"
+"            break;\n"
+"        cur = next;\n"
+"        off++;\n"
+"        if(targets[cur]) {\n"
+"            *target = targets[cur];\n"
+"            *targ_off = off;\n"
+"        }\n"
+"    }\n"
+"    *state = cur;\n"
+"    return off;\n"
+"}\n";
+
+static char lexer_h_lazy[] =
+"    struct lexer_lazy_s *lazy;\n";
+
+static char lexer_c_lazy[] =
+"#ifndef LEXER_LAZY_MAX_STATES\n"
+"#define LEXER_LAZY_MAX_STATES 4096\n"
+"#endif\n"
+"#ifndef LEXER_LAZY_MAX_POS\n"
+"#define LEXER_LAZY_MAX_POS (1 << 20)\n"
+"#endif\n"
+"#if LEXER_LAZY_MAX_STATES < 2\n"
+"#error LEXER_LAZY_MAX_STATES must hold the start state and one more\n"
+"#endif\n"
+"// hash table is probed with a mask, so its size is the power of two\n"
+"// not less than twice the number of states\n"
+"#define LEXER_LAZY_H0 (LEXER_LAZY_MAX_STATES*2UL-1)\n"
+"#define LEXER_LAZY_H1 (LEXER_LAZY_H0 | LEXER_LAZY_H0 >> 1)\n"
+"#define LEXER_LAZY_H2 (LEXER_LAZY_H1 | LEXER_LAZY_H1 >> 2)\n"
+"#define LEXER_LAZY_H3 (LEXER_LAZY_H2 | LEXER_LAZY_H2 >> 4)\n"
+"#define LEXER_LAZY_H4 (LEXER_LAZY_H3 | LEXER_LAZY_H3 >> 8)\n"
+"#define LEXER_LAZY_HSIZE ((LEXER_LAZY_H4 | LEXER_LAZY_H4 >> 16) + 1)\n"
+"#define LEXER_POS_WORDS ((LEXER_NUM_POS+63)/64)\n"
+"\n"
+"// DFA states are built from the position automaton on demand and\n"
+"// cached. When the cache is full, it is flushed and built again.\n"
+"struct lexer_lazy_s {\n"
+"    int *trans;\n"
+"    lexer_action_t *targets;\n"
+"    unsigned int *set_off, *set_len, *hashes;\n"
+"    unsigned int *sets;\n"
+"    size_t max_sets, num_sets;\n"
+"    unsigned int num_states;\n"
+"    unsigned int *htab;\n"
+"    unsigned long long *bits;\n"
+"    unsigned int *set;\n"
+"};\n"
+"\n"
+"static inline unsigned int lexer_lazy_hash(const unsigned int *set, size_t len) {\n"
+"    unsigned int hash = 2166136261u;\n"
+"    for(size_t i = 0; i < len; i++) {\n"
+"        hash ^= set[i];\n"
+"        hash *= 16777619u;\n"
+"    }\n"
+"    return hash ^ (hash >> 15);\n"
+"}\n"
+"\n"
+"static void lexer_lazy_flush(struct lexer_lazy_s *z) {\n"
+"    memset(z->htab, 0, LEXER_LAZY_HSIZE*sizeof(unsigned int));\n"
+"    memset(z->trans, -1, LEXER_NUM_CLASSES*sizeof(int));\n"
+"    z->num_states = 1;\n"
+"    z->num_sets = LEXER_START_LEN;\n"
+"}\n"
+"\n"
+"static int lexer_engine_init(lexer_t *lex) {\n"
+"    struct lexer_lazy_s *z = calloc(1, sizeof(struct lexer_lazy_s));\n"
+"    lex->lazy = z;\n"
+"    if(!z) {\n"
+"        perror(\"calloc\");\n"
+"        return -1;\n"
+"    }\n"
+"\n"
+"    // the biggest state must fit after the start state\n"
+"    z->max_sets = LEXER_LAZY_MAX_POS;\n"
+"    if(z->max_sets < LEXER_START_LEN + LEXER_NUM_POS)\n"
+"        z->max_sets = LEXER_START_LEN + LEXER_NUM_POS;\n"
+"\n"
+"    z->trans = malloc(LEXER_LAZY_MAX_STATES*LEXER_NUM_CLASSES*sizeof(int));\n"
+"    z->targets = malloc(LEXER_LAZY_MAX_STATES*sizeof(lexer_action_t));\n"
+"    z->set_off = malloc(LEXER_LAZY_MAX_STATES*sizeof(unsigned int));\n"
+"    z->set_len = malloc(LEXER_LAZY_MAX_STATES*sizeof(unsigned int));\n"
+"    z->hashes = malloc(LEXER_LAZY_MAX_STATES*sizeof(unsigned int));\n"
+"    z->sets = malloc(z->max_sets*sizeof(unsigned int));\n"
+"    z->htab = malloc(LEXER_LAZY_HSIZE*sizeof(unsigned int));\n"
+"    z->bits = calloc(LEXER_POS_WORDS, sizeof(unsigned long long));\n"
+"    z->set = malloc(LEXER_NUM_POS*sizeof(unsigned int));\n"
+"    if(!z->trans || !z->targets || !z->set_off || !z->set_len || !z->hashes ||\n"
+"       !z->sets || !z->htab || !z->bits || !z->set) {\n"
+"        perror(\"malloc\");\n"
+"        return -1;\n"
+"    }\n"
+"\n"
+"    // the start state is never looked up, 0 means \"no transition\"\n"
+"    memcpy(z->sets, lazy_start, LEXER_START_LEN*sizeof(unsigned int));\n"
+"    z->set_off[0] = 0;\n"
+"    z->set_len[0] = LEXER_START_LEN;\n"
+"    z->targets[0] = NULL;\n"
+"    lexer_lazy_flush(z);\n"
+"    return 0;\n"
+"}\n"
+"\n"
+"static void lexer_engine_free(lexer_t *lex) {\n"
+"    struct lexer_lazy_s *z = lex->lazy;\n"
+"    if(!z)\n"
+"        return;\n"
+"    free(z->trans);\n"
+"    free(z->targets);\n"
+"    free(z->set_off);\n"
+"    free(z->set_len);\n"
+"    free(z->hashes);\n"
+"    free(z->sets);\n"
+"    free(z->htab);\n"
+"    free(z->bits);\n"
+"    free(z->set);\n"
+"    free(z);\n"
+"}\n"
+"\n"
+"static int lexer_lazy_build(struct lexer_lazy_s *z, int state, int cls) {\n"
+"    unsigned int *cur = z->sets + z->set_off[state];\n"
+"    unsigned int cur_len = z->set_len[state];\n"
+"    unsigned int lo = LEXER_POS_WORDS, hi = 0, len = 0;\n"
+"\n"
+"    // union of followpos of every position matching the class\n"
+"    for(unsigned int i = 0; i < cur_len && cur[i] < LEXER_NUM_SYMS; i++) {\n"
+"        unsigned int p = cur[i];\n"
+"        if(!(pos_classes[p][cls >> 6] & (1ULL << (cls & 63))))\n"
+"            continue;\n"
+"        for(unsigned int j = follow_off[p]; j < follow_off[p+1]; j++)\n"
+"            z->bits[follow[j] >> 6] |= 1ULL << (follow[j] & 63);\n"
+"        if(follow_off[p] < follow_off[p+1]) {\n"
+"            if((follow[follow_off[p]] >> 6) < lo)\n"
+"                lo = follow[follow_off[p]] >> 6;\n"
+"            if((follow[follow_off[p+1]-1] >> 6) > hi)\n"
+"                hi = follow[follow_off[p+1]-1] >> 6;\n"
+"        }\n"
+"    }\n"
+"    for(unsigned int w = lo; w <= hi; w++) {\n"
+"        while(z->bits[w]) {\n"
+"            z->set[len++] = (w << 6) | __builtin_ctzll(z->bits[w]);\n"
+"            z->bits[w] &= z->bits[w]-1;\n"
+"        }\n"
+"    }\n"
+"\n"
+"    if(len == 0) {\n"
+"        z->trans[state*LEXER_NUM_CLASSES + cls] = 0;\n"
+"        return 0;\n"
+"    }\n"
+"\n"
+"    unsigned int hash = lexer_lazy_hash(z->set, len);\n"
+"    unsigned int h = hash & (LEXER_LAZY_HSIZE-1), s;\n"
+"    while((s = z->htab[h])) {\n"
+"        if(z->hashes[s] == hash && z->set_len[s] == len &&\n"
+"           !memcmp(z->sets + z->set_off[s], z->set, len*sizeof(unsigned int))) {\n"
+"            z->trans[state*LEXER_NUM_CLASSES + cls] = s;\n"
+"            return s;\n"
+"        }\n"
+"        h = (h+1) & (LEXER_LAZY_HSIZE-1);\n"
+"    }\n"
+"\n"
+"    // after a flush only the new state is needed, the caller\n"
+"    // doesn't use the current one anymore\n"
+"    if(z->num_states == LEXER_LAZY_MAX_STATES || z->num_sets + len > z->max_sets) {\n"
+"        lexer_lazy_flush(z);\n"
+"        state = -1;\n"
+"        h = hash & (LEXER_LAZY_HSIZE-1);\n"
+"    }\n"
+"\n"
+"    s = z->num_states++;\n"
+"    z->htab[h] = s;\n"
+"    z->hashes[s] = hash;\n"
+"    z->set_off[s] = z->num_sets;\n"
+"    z->set_len[s] = len;\n"
+"    memcpy(z->sets + z->num_sets, z->set, len*sizeof(unsigned int));\n"
+"    z->num_sets += len;\n"
+"    memset(z->trans + s*LEXER_NUM_CLASSES, -1, LEXER_NUM_CLASSES*sizeof(int));\n"
+"\n"
+"    // the smallest end marker selects the target\n"
+"    z->targets[s] = NULL;\n"
+"    for(unsigned int i = 0; i < len; i++) {\n"
+"        if(z->set[i] >= LEXER_NUM_SYMS) {\n"
+"            z->targets[s] = end_targets[z->set[i] - LEXER_NUM_SYMS];\n"
+"            break;\n"
+"        }\n"
+"    }\n"
+"\n"
+"    if(state >= 0)\n"
+"        z->trans[state*LEXER_NUM_CLASSES + cls] = s;\n"
+"    return s;\n"
+"}\n"
+"\n"
+"static inline int lexer_step(lexer_t *lex, int state, unsigned char c) {\n"
+"    int next = lex->lazy->trans[state*LEXER_NUM_CLASSES + classes[c]];\n"
+"    return next >= 0 ? next : lexer_lazy_build(lex->lazy, state, classes[c]);\n"
+"}\n"
+"\n"
+"static inline lexer_action_t lexer_target(lexer_t *lex, int state) {\n"
+"    return lex->lazy->targets[state];\n"
+"}\n"
+"\n";
+
+static char lexer_h_bitpar[] =
+"    unsigned long long active[%lu];\n";
+
+static char lexer_c_bitpar[] =
+"static inline int lexer_engine_init(lexer_t *lex) {\n"
+"    return 0;\n"
+"}\n"
+"\n"
+"static inline void lexer_engine_free(lexer_t *lex) {\n"
+"}\n"
+"\n"
+"// The position automaton is simulated with bit masks. lex->active is the\n"
+"// set of active positions, the state is 1 while the set isn't empty.\n"
+"static inline int lexer_step(lexer_t *lex, int state, unsigned char c) {\n"
+"    const unsigned long long *cur = state ? lex->active : start_mask;\n"
+"    const unsigned long long *cm = cls_mask[classes[c]];\n"
+"    unsigned long long next[LEXER_POS_WORDS] = {0}, any = 0;\n"
+"\n"
+"    for(int w = 0; w < LEXER_POS_WORDS; w++) {\n"
+"        unsigned long long m = cur[w] & cm[w];\n"
+"        while(m) {\n"
+"            const unsigned long long *f = follow_mask[(w << 6) | __builtin_ctzll(m)];\n"
+"            m &= m-1;\n"
+"            for(int k = 0; k < LEXER_POS_WORDS; k++)\n"
+"                next[k] |= f[k];\n"
+"        }\n"
+"    }\n"
+"\n"
+"    for(int w = 0; w < LEXER_POS_WORDS; w++) {\n"
+"        lex->active[w] = next[w];\n"
+"        any |= next[w];\n"
+"    }\n"
+"    return any != 0;\n"
+"}\n"
+"\n"
+"// the smallest active end marker selects the target\n"
+"static inline lexer_action_t lexer_target(lexer_t *lex, int state) {\n"
+"    for(int w = LEXER_NUM_SYMS >> 6; w < LEXER_POS_WORDS; w++) {\n"
+"        unsigned long long m = lex->active[w];\n"
+"        if(w == LEXER_NUM_SYMS >> 6)\n"
+"            m &= ~0ULL << (LEXER_NUM_SYMS & 63);\n"
+"        if(m)\n"
+"            return end_targets[((w << 6) | __builtin_ctzll(m)) - LEXER_NUM_SYMS];\n"
+"    }\n"
+"    return NULL;\n"
+"}\n"
+"\n";
@@ -1,16 +1,58 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "htable.h"
+#include "arena.h"
 #include "regexp.h"
 #include "trans.h"
+#include "cache.h"
+#include "keyword.h"
+#include "comb.h"
+#include "profile.h"
+#include "dfa_file.h"
 #include "lexer.h"
 
-static inline bool get_output_names(char *origin, char **head_file, char **src_file) {
-    size_t len = strlen(origin);
+typedef enum { ENGINE_TABLE, ENGINE_DIRECT, ENGINE_LAZY, ENGINE_BITPAR, ENGINE_MMAP } engine_t;
+typedef enum { TABLE_DENSE, TABLE_COMB } table_t;
+
+// -s prints wall time and peak RSS after every phase
+typedef struct {
+    struct timespec start, last;
+} stats_t;
+
+static void stats_init(stats_t *stats) {
+    if(!stats)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &stats->start);
+    stats->last = stats->start;
+}
+
+static double elapsed_ms(struct timespec *from, struct timespec *to) {
+    return (to->tv_sec - from->tv_sec)*1e3 + (to->tv_nsec - from->tv_nsec)/1e6;
+}
+
+static void stats_phase(stats_t *stats, const char *name) {
+    struct timespec now;
+    struct rusage usage;
+
+    if(!stats)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_SELF, &usage);
+    printf("stats: phase %-16s %10.3f ms %10ld KB\n", name, elapsed_ms(&stats->last, &now), usage.ru_maxrss);
+    stats->last = now;
+}
+
+// origin with its extension replaced by ext
+static char* output_name(arena_t *arena, const char *origin, const char *ext) {
+    size_t len = strlen(origin), ext_len = strlen(ext);
     size_t i;
     for(i = len-1; i > 0; i--) {
         if(origin[i] == '.')
@@ -19,36 +61,54 @@ static inline bool get_output_names(char *origin, char **head_file, char **src_f
     if(i != 0)
         len = i+1;
 
-    char *hdr = malloc(len + 2);
-    if(!hdr) {
-        perror("malloc");
-        return false;
-    }
+    char *name = arena_alloc(arena, len + ext_len + 1);
+    if(!name)
+        return NULL;
+    memcpy(name, origin, len);
+    memcpy(name+len, ext, ext_len+1);
+    return name;
+}
 
-    char *src = malloc(len + 2);
-    if(!src) {
-        perror("malloc");
-        free(hdr);
-        return false;
+// outputs are replaced only if their contents differ, so build tools
+// don't rebuild everything what depends on them
+static bool write_if_changed(arena_t *arena, const char *filename, const char *buf, size_t len) {
+    FILE *fd = fopen(filename, "rb");
+    if(fd) {
+        bool same = false;
+        char *old = arena_alloc(arena, len+1);
+        if(old)
+            same = fread(old, 1, len+1, fd) == len && !memcmp(old, buf, len);
+        fclose(fd);
+        if(same)
+            return true;
     }
 
-    memcpy(hdr, origin, len);
-    memcpy(hdr+len, "h", 2);
-    memcpy(src, origin, len);
-    memcpy(src+len, "c", 2);
-    *head_file = hdr;
-    *src_file = src;
-
-    return true;
-}
+    size_t tmp_len = strlen(filename) + 5;
+    char *tmp_name = arena_alloc(arena, tmp_len);
+    if(!tmp_name)
+        return false;
+    snprintf(tmp_name, tmp_len, "%s.tmp", filename);
 
-static inline bool gen_h_file(const char *filename, htable_t *trans_units) {
-    FILE *fd = fopen(filename, "w");
+    fd = fopen(tmp_name, "wb");
     if(!fd) {
         perror("fopen");
         return false;
     }
+    bool ok = fwrite(buf, 1, len, fd) == len;
+    if(fclose(fd) != 0 || !ok) {
+        perror("write");
+        unlink(tmp_name);
+        return false;
+    }
+    if(rename(tmp_name, filename) < 0) {
+        perror("rename");
+        unlink(tmp_name);
+        return false;
+    }
+    return true;
+}
 
+static inline void gen_h_file(FILE *fd, htable_t *trans_units, engine_t engine, regexp_stat *st) {
     unit_node_t key_node, *header_node, *include_node;
     key_node.title = "header";
     key_node.title_len = 6;
@@ -67,18 +127,416 @@ static inline bool gen_h_file(const char *filename, htable_t *trans_units) {
         fputs(include_node->content, fd);
 
     fprintf(fd, "\n%s", header_node->content);
+    fputs(lexer_h_struct, fd);
+    if(engine == ENGINE_LAZY)
+        fputs(lexer_h_lazy, fd);
+    else if(engine == ENGINE_BITPAR)
+        fprintf(fd, lexer_h_bitpar, (st->num_syms + st->num_ends + 63) >> 6);
+    else if(engine == ENGINE_MMAP)
+        fputs(lexer_h_mmap, fd);
     fputs(lexer_h, fd);
-    fclose(fd);
-    return true;
+    if(engine == ENGINE_MMAP)
+        fputs(lexer_h_mmap_api, fd);
 }
 
-static inline bool gen_c_file(const char *filename, char *hdr_name, htable_t *trans_units, regexp_func_t *funcs, size_t num_funcs, dfa_t *dfa) {
-    FILE *fd = fopen(filename, "w");
-    if(!fd) {
-        perror("fopen");
+static void gen_classes(FILE *fd, unsigned char *classes, size_t num_classes) {
+    fprintf(fd, "\n#define LEXER_NUM_CLASSES %lu\n", num_classes);
+    fputs("\nstatic unsigned char classes[] = { ", fd);
+    for(int c = 0; c < 255; c++)
+        fprintf(fd, "%d, ", classes[c]);
+    fprintf(fd, "%d };\n", classes[255]);
+}
+
+static void gen_target(FILE *fd, regexp_func_t *funcs, void *target) {
+    if(!target)
+        fputs("NULL", fd);
+    else
+        fprintf(fd, "f%lu", (size_t)((regexp_func_t*)target - funcs));
+}
+
+// the smallest unsigned type which holds every value
+static void gen_uint_array(FILE *fd, const char *name, const uint32_t *vals, size_t num_vals) {
+    uint32_t max = 0;
+    for(size_t i = 0; i < num_vals; i++) {
+        if(vals[i] > max)
+            max = vals[i];
+    }
+    fprintf(fd, "\nstatic const %s %s[] = { ",
+            max <= 255 ? "unsigned char" : max <= 65535 ? "unsigned short" : "unsigned int", name);
+    for(size_t i = 0; i < num_vals; i++)
+        fprintf(fd, i+1 < num_vals ? "%u, " : "%u };\n", vals[i]);
+}
+
+static void gen_dfa_tables(FILE *fd, regexp_func_t *funcs, dfa_t *dfa) {
+    gen_classes(fd, dfa->classes, dfa->num_classes);
+    gen_uint_array(fd, "states", dfa->states, dfa->num_states*dfa->num_classes);
+
+    fputs("\nstatic lexer_action_t targets[] = { ", fd);
+    for(size_t i = 0; i < dfa->num_targets; i++) {
+        gen_target(fd, funcs, dfa->targets[i]);
+        if(i+1 < dfa->num_targets)
+            fputs(", ", fd);
+    }
+    fputs(" };\n\n", fd);
+}
+
+static void gen_comb_tables(FILE *fd, regexp_func_t *funcs, dfa_t *dfa, dfa_comb_t *comb) {
+    gen_classes(fd, dfa->classes, dfa->num_classes);
+    gen_uint_array(fd, "comb_base", comb->base, comb->num_states);
+    gen_uint_array(fd, "comb_default", comb->deflt, comb->num_states);
+    gen_uint_array(fd, "comb_next", comb->next, comb->num_entries);
+    gen_uint_array(fd, "comb_check", comb->check, comb->num_entries);
+
+    fputs("\nstatic lexer_action_t targets[] = { ", fd);
+    for(size_t i = 0; i < dfa->num_targets; i++) {
+        gen_target(fd, funcs, dfa->targets[i]);
+        if(i+1 < dfa->num_targets)
+            fputs(", ", fd);
+    }
+    fputs(" };\n\n", fd);
+}
+
+// counts of a DFA state for a profiling build: state numbers before
+// renumbering and the byte classes, which the direct engine has no use for
+// otherwise
+static void gen_prof(FILE *fd, engine_t engine, dfa_t *dfa, dfa_profile_t *prof) {
+    fputs("\n#ifdef LEXER_PROFILE", fd);
+    if(engine == ENGINE_DIRECT)
+        gen_classes(fd, dfa->classes, dfa->num_classes);
+    fprintf(fd, "\n#define LEXER_NUM_STATES %lu\n", dfa->num_states);
+    fprintf(fd, "#define LEXER_PROF_HASH \"%016llx\"\n", (unsigned long long)(prof ? prof->hash : profile_dfa_hash(dfa)));
+    if(prof) {
+        gen_uint_array(fd, "prof_ids", prof->ids, dfa->num_states);
+        fputs("#define LEXER_PROF_ID(s) prof_ids[s]\n", fd);
+    } else {
+        fputs("#define LEXER_PROF_ID(s) (s)\n", fd);
+    }
+    fputs("#endif\n\n", fd);
+    fputs(lexer_c_prof, fd);
+}
+
+typedef struct {
+    int lo, hi;
+    int next;
+    // profiled transitions of the run
+    uint64_t weight;
+} byte_run_t;
+
+// few ranges are compared one by one, otherwise the compiler
+// chooses how to dispatch a switch over bytes
+#define DIRECT_MAX_RANGES 3
+
+// self transitions of a state with a loop go to l<N>, which skips the loop
+static void gen_goto(FILE *fd, int next, int loop) {
+    fprintf(fd, "goto %c%d;\n", next == loop ? 'l' : 's', next);
+}
+
+static void gen_state_code(FILE *fd, byte_run_t *runs, size_t num_runs, int loop) {
+    size_t num_live = 0;
+    for(size_t i = 0; i < num_runs; i++)
+        num_live += runs[i].next != 0;
+
+    // the most taken ranges are compared first
+    if(num_live <= DIRECT_MAX_RANGES) {
+        byte_run_t live[DIRECT_MAX_RANGES], tmp;
+        size_t n = 0;
+        for(size_t i = 0; i < num_runs; i++) {
+            if(!runs[i].next)
+                continue;
+            live[n] = runs[i];
+            for(size_t j = n++; j > 0 && live[j].weight > live[j-1].weight; j--) {
+                tmp = live[j];
+                live[j] = live[j-1];
+                live[j-1] = tmp;
+            }
+        }
+        runs = live;
+        num_runs = n;
+        for(size_t i = 0; i < num_runs; i++) {
+            if(runs[i].lo == runs[i].hi)
+                fprintf(fd, "    if(c == %d) ", runs[i].lo);
+            else if(runs[i].lo == 0)
+                fprintf(fd, "    if(c <= %d) ", runs[i].hi);
+            else if(runs[i].hi == 255)
+                fprintf(fd, "    if(c >= %d) ", runs[i].lo);
+            else
+                fprintf(fd, "    if(c >= %d && c <= %d) ", runs[i].lo, runs[i].hi);
+            gen_goto(fd, runs[i].next, loop);
+        }
+        return;
+    }
+
+    // cases of one destination are written together
+    fputs("    switch(c) {\n", fd);
+    for(size_t i = 0; i < num_runs; i++) {
+        int next = runs[i].next;
+        if(!next)
+            continue;
+        bool seen = false;
+        for(size_t j = 0; j < i && !seen; j++)
+            seen = runs[j].next == next;
+        if(seen)
+            continue;
+
+        fputs("    ", fd);
+        for(size_t j = i; j < num_runs; j++) {
+            if(runs[j].next != next)
+                continue;
+            for(int c = runs[j].lo; c <= runs[j].hi; c++)
+                fprintf(fd, "case %d: ", c);
+        }
+        gen_goto(fd, next, loop);
+    }
+    fputs("    }\n", fd);
+}
+
+// self loops of at most this many byte ranges are skipped by SIMD code
+#define LOOP_MAX_RANGES 4
+
+// bytes which keep a state other than the start one in itself as ranges,
+// 0 if there are none or too many ranges
+static size_t state_loop(dfa_t *dfa, size_t s, int *lo, int *hi) {
+    uint32_t *row = dfa->states + s*dfa->num_classes;
+    size_t n = 0;
+
+    for(int c = 0; c < 256; c++) {
+        if(row[dfa->classes[c]] != s)
+            continue;
+        if(n > 0 && hi[n-1] == c-1) {
+            hi[n-1] = c;
+        } else if(n < LOOP_MAX_RANGES) {
+            lo[n] = hi[n] = c;
+            n++;
+        } else {
+            return 0;
+        }
+    }
+    return n;
+}
+
+// the table engines look loops up by state in loop_ids, the direct engine
+// numbers them in the same order
+static void gen_loops(FILE *fd, dfa_t *dfa, bool by_state) {
+    int lo[LOOP_MAX_RANGES], hi[LOOP_MAX_RANGES];
+    size_t num_loops = 0, n;
+
+    for(size_t s = 1; s < dfa->num_states; s++)
+        num_loops += state_loop(dfa, s, lo, hi) > 0;
+    if(num_loops == 0)
+        return;
+
+    fprintf(fd, "\n#define LEXER_LOOP_RANGES %d\n", LOOP_MAX_RANGES);
+    fputs(lexer_c_loop, fd);
+    fputs("\nstatic const lexer_loop_t lexer_loops[] = {\n", fd);
+    for(size_t s = 1; s < dfa->num_states; s++) {
+        if(!(n = state_loop(dfa, s, lo, hi)))
+            continue;
+        fputs("    { { ", fd);
+        for(size_t i = 0; i < LOOP_MAX_RANGES; i++)
+            fprintf(fd, i+1 < LOOP_MAX_RANGES ? "%d, " : "%d }, { ", lo[i < n ? i : 0]);
+        for(size_t i = 0; i < LOOP_MAX_RANGES; i++)
+            fprintf(fd, i+1 < LOOP_MAX_RANGES ? "%d, " : "%d } },\n", hi[i < n ? i : 0] - lo[i < n ? i : 0]);
+    }
+    fputs("};\n", fd);
+    if(!by_state)
+        return;
+
+    fprintf(fd, "\n#define LEXER_LOOPS\nstatic const %s loop_ids[] = { 0",
+            num_loops < 255 ? "unsigned char" : num_loops < 65535 ? "unsigned short" : "unsigned int");
+    num_loops = 0;
+    for(size_t s = 1; s < dfa->num_states; s++)
+        fprintf(fd, ", %lu", state_loop(dfa, s, lo, hi) ? ++num_loops : 0);
+    fputs(" };\n", fd);
+}
+
+// lexer_scan with a label for every state: the state is kept in the program
+// counter and targets are constants, so there are no tables to load from.
+// Accepting states record the target at s<N>, a scan stopped at the end of
+// the buffer resumes after that at r<N>. The start state never accepts.
+static void gen_direct_code(FILE *fd, regexp_func_t *funcs, dfa_t *dfa, dfa_profile_t *prof) {
+    byte_run_t runs[256];
+    size_t num_runs, num_loops = 0;
+    int lo[LOOP_MAX_RANGES], hi[LOOP_MAX_RANGES];
+
+    fputs(lexer_c_direct, fd);
+    fputs("\nstatic inline size_t lexer_scan(lexer_t *lex, int *state, const unsigned char *buf, size_t off, size_t len, lexer_action_t *target, size_t *targ_off) {\n", fd);
+    fputs("    unsigned char c;\n\n", fd);
+    fputs("    switch(*state) {\n", fd);
+    for(size_t s = 1; s < dfa->num_states; s++)
+        fprintf(fd, "    case %lu: goto %c%lu;\n", s, dfa->targets[s] ? 'r' : 's', s);
+    fputs("    }\n", fd);
+
+    for(size_t s = 0; s < dfa->num_states; s++) {
+        uint32_t *row = dfa->states + s*dfa->num_classes;
+
+        // the start state isn't a transition target, it follows the switch
+        if(s > 0)
+            fprintf(fd, "\ns%lu:\n", s);
+        if(s > 0 && dfa->targets[s]) {
+            fputs("    *target = ", fd);
+            gen_target(fd, funcs, dfa->targets[s]);
+            fprintf(fd, ";\n    *targ_off = off;\nr%lu:\n", s);
+        }
+
+        num_runs = 0;
+        for(int c = 0; c < 256; c++) {
+            int next = row[dfa->classes[c]];
+            if(num_runs > 0 && runs[num_runs-1].next == next)
+                runs[num_runs-1].hi = c;
+            else
+                runs[num_runs++] = (byte_run_t){ c, c, next, 0 };
+        }
+        for(size_t i = 0; i < num_runs && prof; i++) {
+            bool seen[256] = { false };
+            for(int c = runs[i].lo; c <= runs[i].hi; c++) {
+                unsigned char cls = dfa->classes[c];
+                if(!seen[cls])
+                    runs[i].weight += prof->edges[s*dfa->num_classes + cls];
+                seen[cls] = true;
+            }
+        }
+        if(num_runs == 1 && runs[0].next == 0) {
+            fprintf(fd, "    *state = %lu;\n    return off;\n", s);
+            continue;
+        }
+
+        fprintf(fd, "    if(off == len) {\n        *state = %lu;\n        return off;\n    }\n", s);
+        fputs("    c = buf[off++];\n", fd);
+        fprintf(fd, "    LEXER_PROF_STEP(%lu, c);\n", s);
+        bool loop = s > 0 && state_loop(dfa, s, lo, hi);
+        gen_state_code(fd, runs, num_runs, loop ? (int)s : -1);
+        fprintf(fd, "    *state = %lu;\n    return off-1;\n", s);
+        if(loop) {
+            fprintf(fd, "l%lu:\n    off = LEXER_SKIP(&lexer_loops[%lu], buf, off, len);\n", s, num_loops++);
+            fprintf(fd, "    goto s%lu;\n", s);
+        }
+    }
+    fputs("}\n\n", fd);
+}
+
+// actions of rules numbered in the DFA file and its name, the tables are
+// in the file
+static void gen_mmap_code(FILE *fd, char *dfa_name, size_t num_funcs) {
+    char *rel_name = strrchr(dfa_name, '/');
+    rel_name = rel_name ? rel_name+1 : dfa_name;
+
+    fprintf(fd, "\n#define LEXER_NUM_RULES %lu\n", num_funcs);
+    fprintf(fd, "#define LEXER_DFA_VERSION %d\n", DFA_FILE_VERSION);
+    fprintf(fd, "#ifndef LEXER_DFA_FILE\n#define LEXER_DFA_FILE \"%s\"\n#endif\n", rel_name);
+    fputs("\nstatic lexer_action_t rule_actions[] = { ", fd);
+    for(size_t i = 0; i < num_funcs; i++)
+        fprintf(fd, i+1 < num_funcs ? "f%lu, " : "f%lu };\n\n", i);
+    fputs(lexer_c_mmap, fd);
+}
+
+static void gen_words(FILE *fd, const uint64_t *words, size_t num_words) {
+    fputs("{ ", fd);
+    for(size_t w = 0; w < num_words; w++)
+        fprintf(fd, w+1 < num_words ? "0x%llxULL, " : "0x%llxULL", (unsigned long long)words[w]);
+    fputs(" }", fd);
+}
+
+static void gen_end_targets(FILE *fd, regexp_func_t *funcs, regexp_stat *st) {
+    fputs("\nstatic lexer_action_t end_targets[] = { ", fd);
+    for(size_t i = 0; i < st->num_ends; i++) {
+        gen_target(fd, funcs, st->end_targets[i]);
+        if(i+1 < st->num_ends)
+            fputs(", ", fd);
+    }
+    fputs(" };\n\n", fd);
+}
+
+// position automaton for the lazy engine: positions matching each class,
+// followpos in compressed rows and targets of end markers
+static void gen_lazy_tables(FILE *fd, regexp_func_t *funcs, regexp_stat *st) {
+    size_t num_words = (st->num_classes+63) >> 6, off = 0;
+
+    gen_classes(fd, st->classes, st->num_classes);
+    fprintf(fd, "#define LEXER_NUM_SYMS %lu\n", st->num_syms);
+    fprintf(fd, "#define LEXER_NUM_POS %lu\n", st->num_syms + st->num_ends);
+    fprintf(fd, "#define LEXER_START_LEN %lu\n", st->firstpos.num_items);
+
+    fputs("\nstatic const unsigned int lazy_start[] = { ", fd);
+    posset_for_each(i, &st->firstpos)
+        fprintf(fd, i+1 < st->firstpos.items + st->firstpos.num_items ? "%u, " : "%u", *i);
+    fputs(" };\n", fd);
+
+    fputs("\nstatic const unsigned long long pos_classes[][", fd);
+    fprintf(fd, "%lu] = {\n", num_words);
+    for(size_t p = 0; p < st->num_syms; p++) {
+        fputs("    ", fd);
+        gen_words(fd, st->sym_classes[p], num_words);
+        fputs(p+1 < st->num_syms ? ",\n" : "\n", fd);
+    }
+    fputs("};\n", fd);
+
+    fputs("\nstatic const unsigned int follow_off[] = { 0", fd);
+    for(size_t p = 0; p < st->num_syms; p++) {
+        off += st->followpos[p].num_items;
+        fprintf(fd, ", %lu", off);
+    }
+    fputs(" };\n", fd);
+
+    fputs("\nstatic const unsigned int follow[] = { ", fd);
+    for(size_t p = 0, n = 0; p < st->num_syms; p++) {
+        posset_for_each(i, &st->followpos[p])
+            fprintf(fd, ++n < off ? "%u, " : "%u", *i);
+    }
+    fputs(" };\n", fd);
+
+    gen_end_targets(fd, funcs, st);
+}
+
+static void posset_to_words(const posset_t *s, uint64_t *words, size_t num_words) {
+    memset(words, 0, num_words*sizeof(uint64_t));
+    posset_for_each(i, s)
+        words[*i >> 6] |= 1ULL << (*i & 63);
+}
+
+// bit masks for the bit-parallel engine: start positions, positions
+// matching each class and followpos of each position
+static bool gen_bitpar_tables(FILE *fd, arena_t *arena, regexp_func_t *funcs, regexp_stat *st) {
+    size_t num_words = (st->num_syms + st->num_ends + 63) >> 6;
+    uint64_t *words = arena_calloc(arena, num_words, sizeof(uint64_t));
+    if(!words)
         return false;
+
+    gen_classes(fd, st->classes, st->num_classes);
+    fprintf(fd, "#define LEXER_NUM_SYMS %lu\n", st->num_syms);
+    fprintf(fd, "#define LEXER_POS_WORDS %lu\n", num_words);
+
+    posset_to_words(&st->firstpos, words, num_words);
+    fputs("\nstatic const unsigned long long start_mask[] = ", fd);
+    gen_words(fd, words, num_words);
+    fputs(";\n", fd);
+
+    fputs("\nstatic const unsigned long long cls_mask[][LEXER_POS_WORDS] = {\n", fd);
+    for(size_t cls = 0; cls < st->num_classes; cls++) {
+        memset(words, 0, num_words*sizeof(uint64_t));
+        for(size_t p = 0; p < st->num_syms; p++) {
+            if(st->sym_classes[p][cls >> 6] & (1ULL << (cls & 63)))
+                words[p >> 6] |= 1ULL << (p & 63);
+        }
+        fputs("    ", fd);
+        gen_words(fd, words, num_words);
+        fputs(cls+1 < st->num_classes ? ",\n" : "\n", fd);
     }
+    fputs("};\n", fd);
+
+    fputs("\nstatic const unsigned long long follow_mask[][LEXER_POS_WORDS] = {\n", fd);
+    for(size_t p = 0; p < st->num_syms; p++) {
+        posset_to_words(&st->followpos[p], words, num_words);
+        fputs("    ", fd);
+        gen_words(fd, words, num_words);
+        fputs(p+1 < st->num_syms ? ",\n" : "\n", fd);
+    }
+    fputs("};\n", fd);
 
+    gen_end_targets(fd, funcs, st);
+    return true;
+}
+
+static inline bool gen_c_file(FILE *fd, arena_t *arena, char *hdr_name, char *dfa_name, htable_t *trans_units, regexp_func_t *funcs, size_t num_funcs, engine_t engine, dfa_t *dfa, dfa_comb_t *comb, dfa_profile_t *prof, regexp_stat *st, kw_set_t *kw) {
     char *rel_hdr = strrchr(hdr_name, '/');
     if(!rel_hdr)
         rel_hdr = hdr_name;
@@ -94,8 +552,13 @@ static inline bool gen_c_file(const char *filename, char *hdr_name, htable_t *tr
         if(!include_node || !strstr(include_node->content, lexer_c_headers[i]))
             fprintf(fd, "#include <%s>\n", lexer_c_headers[i]);
     }
+    for(int i = 0; engine == ENGINE_MMAP && i < sizeof(lexer_c_mmap_headers)/sizeof(*lexer_c_mmap_headers); i++) {
+        if(!include_node || !strstr(include_node->content, lexer_c_mmap_headers[i]))
+            fprintf(fd, "#include <%s>\n", lexer_c_mmap_headers[i]);
+    }
     if(include_node)
         fputs(include_node->content, fd);
+    fputs(lexer_c_str, fd);
 
     key_node.title = "funcs";
     key_node.title_len = 5;
@@ -103,73 +566,269 @@ static inline bool gen_c_file(const char *filename, char *hdr_name, htable_t *tr
     if(funcs_node)
         fprintf(fd, "%s\n", funcs_node->content);
 
-    for(size_t i = 0; i < num_funcs; i++)
-        fprintf(fd, "static int f%lu(lexeme_t *lex) %s\n", i, funcs[i].func);
+    // actions of keyword hosts are called by the keyword lookup
+    for(size_t i = 0; i < num_funcs; i++) {
+        if(kw && kw_host_table(kw, i) >= 0)
+            fprintf(fd, "static int f%lu_rule(lexeme_t *lex) %s\n", i, funcs[i].func);
+        else
+            fprintf(fd, "static int f%lu(lexeme_t *lex) %s\n", i, funcs[i].func);
+    }
 
-    if(dfa->num_states <= 255)
-        fputs("\nstatic unsigned char states[] = { ", fd);
-    else
-        fputs("\nstatic unsigned short states[] = { ", fd);
+    fputs("\ntypedef int (*lexer_action_t)(lexeme_t*);\n", fd);
+    if(kw && kw->num_tables > 0) {
+        fputs(lexer_c_kw, fd);
+        kw_gen(fd, kw);
+    }
+    switch(engine) {
+    case ENGINE_TABLE:
+        if(comb) {
+            gen_comb_tables(fd, funcs, dfa, comb);
+            gen_prof(fd, engine, dfa, prof);
+            gen_loops(fd, dfa, true);
+            fputs(lexer_c_comb, fd);
+        } else {
+            gen_dfa_tables(fd, funcs, dfa);
+            gen_prof(fd, engine, dfa, prof);
+            gen_loops(fd, dfa, true);
+            fputs(lexer_c_table, fd);
+        }
+        break;
+    case ENGINE_DIRECT:
+        gen_prof(fd, engine, dfa, prof);
+        gen_loops(fd, dfa, false);
+        gen_direct_code(fd, funcs, dfa, prof);
+        break;
+    case ENGINE_LAZY:
+        gen_lazy_tables(fd, funcs, st);
+        fputs(lexer_c_lazy, fd);
+        break;
+    case ENGINE_BITPAR:
+        if(!gen_bitpar_tables(fd, arena, funcs, st))
+            return false;
+        fputs(lexer_c_bitpar, fd);
+        break;
+    case ENGINE_MMAP:
+        gen_mmap_code(fd, dfa_name, num_funcs);
+        break;
+    }
+    if(engine != ENGINE_DIRECT && engine != ENGINE_MMAP)
+        fputs(lexer_c_scan, fd);
+    fputs(lexer_c, fd);
+    return true;
+}
+
+// rules with a non-zero host are left out
+static regexp_stat* rules_stat(arena_t *arena, regexp_func_t *regexp_funcs, size_t num_regexp_funcs, uint32_t *hosts, stats_t *stats) {
+    regexp_stat *st = NULL;
+    htable_t *regexp_ptrs = NULL;
+    syn_tree_t *root = NULL, *cur, *tmp;
+    size_t off;
+    bool error = false;
 
-    size_t num_states = dfa->num_states*255-1;
-    for(size_t i = 0; i < num_states; i++)
-        fprintf(fd, "%d, ", dfa->states[i]);
-    fprintf(fd, "%d };\n", dfa->states[num_states]);
+    regexp_ptrs = sym_ptr_htable_init();
+    if(!regexp_ptrs)
+        goto exit;
 
-    fputs("\nstatic int (*targets[])(lexeme_t*) = { ", fd);
-    for(size_t i = 0; i < dfa->num_targets; i++) {
-        if(!dfa->targets[i]) {
-            fputs("NULL", fd);
+    // rules are joined into a left-nested OR chain, so the accumulated
+    // firstpos and lastpos are appended to instead of being copied every rule
+    for(size_t i = 0; i < num_regexp_funcs; i++) {
+        if(hosts && hosts[i])
+            continue;
+        cur = parse_regexp(arena, regexp_funcs[i].regexp, regexp_funcs[i].regexp_len, &off, &error);
+        if(error)
+            goto exit;
+        if(!cur) {
+            fprintf(stderr, "Regexp of rule %lu is empty\n", i+1);
+            goto exit;
+        }
+
+        if(root) {
+            tmp = arena_alloc(arena, sizeof(syn_tree_t));
+            if(!tmp)
+                goto exit;
+            tmp->tag = OR;
+            tmp->or.s1 = root;
+            tmp->or.s2 = cur;
+            root = tmp;
         } else {
-            size_t fnum = (dfa->targets[i]-(void*)funcs)/sizeof(*funcs);
-            fprintf(fd, "f%lu", fnum);
+            root = cur;
         }
 
-        if(i+1 < dfa->num_targets)
-            fputs(", ", fd);
+        if(!regexp_assoc_ptr(regexp_ptrs, cur, &regexp_funcs[i]))
+            goto exit;
     }
-    fputs(" };\n\n", fd);
-    fputs(lexer_c, fd);
 
-    fclose(fd);
-    return true;
+    stats_phase(stats, "parse_regexp");
+    if(!root) {
+        fputs("Internal error: no rules left\n", stderr);
+        goto exit;
+    }
+
+    // targets are resolved here, regexp_ptrs isn't needed after
+    st = get_regexp_stat(arena, root, regexp_ptrs);
+    stats_phase(stats, "get_regexp_stat");
+exit:
+    if(regexp_ptrs) htable_free(regexp_ptrs);
+    return st;
+}
+
+// keyword candidates are resolved on the automaton without them,
+// the ones without a host are added back
+static regexp_stat* build_stat(arena_t *arena, regexp_func_t *regexp_funcs, size_t num_regexp_funcs, kw_set_t *kw, stats_t *stats) {
+    regexp_stat *st = NULL;
+    size_t num_kept, num_other = 0;
+
+    if(kw) {
+        for(size_t i = 0; i < num_regexp_funcs; i++)
+            num_other += kw->hosts[i] == 0;
+        if(num_other == 0)
+            memset(kw->hosts, 0, num_regexp_funcs*sizeof(uint32_t));
+    }
+
+    if(kw && num_other > 0) {
+        st = rules_stat(arena, regexp_funcs, num_regexp_funcs, kw->hosts, stats);
+        if(!st || !kw_resolve(kw, st, regexp_funcs, &num_kept))
+            return NULL;
+        stats_phase(stats, "kw_resolve");
+        if(num_kept > 0)
+            st = rules_stat(arena, regexp_funcs, num_regexp_funcs, kw->hosts, stats);
+    } else {
+        st = rules_stat(arena, regexp_funcs, num_regexp_funcs, kw ? kw->hosts : NULL, stats);
+    }
+
+    if(st && stats)
+        printf("stats: positions %lu\nstats: classes %lu\n", st->num_syms + st->num_ends, st->num_classes);
+    return st;
+}
+
+static dfa_t* build_dfa(arena_t *arena, regexp_stat *st, size_t num_threads, stats_t *stats) {
+    dfa_t *dfa;
+    size_t removed;
+
+    dfa = regexp_to_dfa(arena, st, num_threads);
+    if(!dfa)
+        return NULL;
+    stats_phase(stats, "regexp_to_dfa");
+    if(stats)
+        printf("stats: dfa_states %lu\n", dfa->num_states);
+
+    if(!dfa_minimize(arena, dfa, &removed))
+        return NULL;
+    stats_phase(stats, "dfa_minimize");
+    if(stats)
+        printf("stats: min_states %lu\n", dfa->num_states);
+    printf("DFA minimization removed %lu states, %lu left\n", removed, dfa->num_states);
+    return dfa;
 }
 
 int main(int argc, char **argv) {
     int ret = 1;
-    char *head_file = NULL, *src_file = NULL;
+    arena_t *arena = NULL;
+    char *head_file = NULL, *src_file = NULL, *dfa_file = NULL;
     htable_t *trans_units = NULL;
     unit_node_t un_key_node, *un_found_node;
     regexp_func_t *regexp_funcs = NULL;
     size_t num_regexp_funcs = 0;
-    htable_t *regexp_ptrs = NULL;
-    syn_tree_t *root = NULL, *cur, *tmp, **rootptr = &root;
-    size_t off;
-    bool error;
     regexp_stat *st = NULL;
     dfa_t *dfa = NULL;
+    size_t num_threads = 1;
+    engine_t engine = ENGINE_TABLE;
+    bool need_dfa;
+    table_t table = TABLE_DENSE;
+    dfa_comb_t *comb = NULL;
+    char *prof_file = NULL;
+    dfa_profile_t *prof = NULL;
+    stats_t stats_buf, *stats = NULL;
+    size_t out_size = 0;
+    char *cache_dir = NULL;
+    bool keywords = true;
+    kw_set_t *kw = NULL;
+    cache_key_t cache_key;
+    FILE *out = NULL;
+    char *out_buf = NULL;
+    size_t out_len;
+    int opt;
+
+    while((opt = getopt(argc, argv, "j:c:e:t:P:sK")) != -1) {
+        switch(opt) {
+        case 'j':
+            num_threads = strtoul(optarg, NULL, 10);
+            if(num_threads == 0 || num_threads > 1024) {
+                fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                goto exit;
+            }
+            break;
+        case 'c':
+            cache_dir = optarg;
+            break;
+        case 'P':
+            prof_file = optarg;
+            break;
+        case 's':
+            stats = &stats_buf;
+            break;
+        case 'K':
+            keywords = false;
+            break;
+        case 'e':
+            if(!strcmp(optarg, "table")) {
+                engine = ENGINE_TABLE;
+            } else if(!strcmp(optarg, "direct")) {
+                engine = ENGINE_DIRECT;
+            } else if(!strcmp(optarg, "lazy")) {
+                engine = ENGINE_LAZY;
+            } else if(!strcmp(optarg, "bitpar")) {
+                engine = ENGINE_BITPAR;
+            } else if(!strcmp(optarg, "mmap")) {
+                engine = ENGINE_MMAP;
+            } else {
+                fprintf(stderr, "Unknown engine: %s\n", optarg);
+                goto exit;
+            }
+            break;
+        case 't':
+            if(!strcmp(optarg, "dense")) {
+                table = TABLE_DENSE;
+            } else if(!strcmp(optarg, "comb")) {
+                table = TABLE_COMB;
+            } else {
+                fprintf(stderr, "Unknown table format: %s\n", optarg);
+                goto exit;
+            }
+            break;
+        default:
+            goto usage;
+        }
+    }
 
-    if(argc != 2) {
-        fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+    if(optind != argc-1) {
+usage:
+        fprintf(stderr, "Usage: %s [-j threads] [-c cachedir] [-e table|direct|lazy|bitpar|mmap] [-t dense|comb] [-P profile] [-s] [-K] <filename>\n", argv[0]);
         goto exit;
     }
-
-    if(!get_output_names(argv[1], &head_file, &src_file))
+    if(prof_file && engine != ENGINE_TABLE && engine != ENGINE_DIRECT) {
+        fputs("Profiles are supported by the table and direct engines only\n", stderr);
         goto exit;
+    }
+    char *trans_file = argv[optind];
 
-    if(access(head_file, F_OK) == 0) {
-        fprintf(stderr, "Can't create file, %s already exist\n", head_file);
+    stats_init(stats);
+
+    // everything the generator builds lives until exit
+    arena = arena_create(1 << 20);
+    if(!arena)
         goto exit;
-    }
 
-    if(access(src_file, F_OK) == 0) {
-        fprintf(stderr, "Can't create file, %s already exist\n", src_file);
+    head_file = output_name(arena, trans_file, "h");
+    src_file = output_name(arena, trans_file, "c");
+    dfa_file = output_name(arena, trans_file, "dfa");
+    if(!head_file || !src_file || !dfa_file)
         goto exit;
-    }
 
-    trans_units = parse_trans_file(argv[1]);
+    trans_units = parse_trans_file(arena, trans_file);
     if(!trans_units)
         goto exit;
+    stats_phase(stats, "parse_trans_file");
 
     if(!check_trans_units(trans_units))
         goto exit;
@@ -177,7 +836,7 @@ int main(int argc, char **argv) {
     un_key_node.title = "regexes";
     un_key_node.title_len = 7;
     un_found_node = (unit_node_t*)htable_lookup(trans_units, (hnode_t*)&un_key_node);
-    regexp_funcs = parse_regexes(un_found_node->content, un_found_node->content_len, &num_regexp_funcs);
+    regexp_funcs = parse_regexes(arena, un_found_node->content, un_found_node->content_len, &num_regexp_funcs);
     if(!regexp_funcs)
         goto exit;
 
@@ -185,69 +844,145 @@ int main(int argc, char **argv) {
         fputs("There is must be at least one regexp\n", stderr);
         goto exit;
     } 
+    stats_phase(stats, "parse_regexes");
+
+    // keyword tables would be compiled into the lexer, the DFA file
+    // of the mmap engine must not depend on them
+    if(engine == ENGINE_MMAP)
+        keywords = false;
+    if(keywords) {
+        kw = kw_find(arena, regexp_funcs, num_regexp_funcs);
+        if(!kw)
+            goto exit;
+        stats_phase(stats, "kw_find");
+    }
 
-    regexp_ptrs = sym_ptr_htable_init();
-    if(!regexp_ptrs)
-        goto exit;
+    // lazy and bit-parallel engines work on the position automaton
+    if(engine == ENGINE_LAZY || engine == ENGINE_BITPAR) {
+        st = build_stat(arena, regexp_funcs, num_regexp_funcs, kw, stats);
+        if(!st)
+            goto exit;
+        printf("%s engine, %lu positions, %lu byte classes\n",
+               engine == ENGINE_LAZY ? "lazy DFA" : "bit-parallel",
+               st->num_syms + st->num_ends, st->num_classes);
+    }
 
-    for(size_t i = 0; i < num_regexp_funcs; i++) {
-        cur = parse_regexp(regexp_funcs[i].regexp, regexp_funcs[i].regexp_len, &off, &error);
-        if(error || !cur)
+    // options which change the DFA must be a part of the cache key
+    need_dfa = engine == ENGINE_TABLE || engine == ENGINE_DIRECT || engine == ENGINE_MMAP;
+    if(need_dfa && cache_dir) {
+        if(!cache_make_key(arena, regexp_funcs, num_regexp_funcs, keywords ? "" : "K", &cache_key))
             goto exit;
+        dfa = cache_load(arena, cache_dir, &cache_key, regexp_funcs, num_regexp_funcs, kw ? kw->hosts : NULL);
+        stats_phase(stats, "cache_load");
+        if(dfa)
+            printf("DFA loaded from cache, %lu states\n", dfa->num_states);
+    }
 
-        if(i+1 < num_regexp_funcs) {
-            tmp = malloc(sizeof(syn_tree_t));
-            if(!tmp) {
-                perror("malloc");
-                goto exit;
-            }
-            tmp->tag = OR;
-            tmp->or.s1 = cur;
-        } else {
-            tmp = cur;
+    if(need_dfa && !dfa) {
+        st = build_stat(arena, regexp_funcs, num_regexp_funcs, kw, stats);
+        if(!st)
+            goto exit;
+        dfa = build_dfa(arena, st, num_threads, stats);
+        if(!dfa)
+            goto exit;
+        // the cache is only an optimization, failing to store isn't fatal
+        if(cache_dir) {
+            cache_store(arena, cache_dir, &cache_key, dfa, regexp_funcs, num_regexp_funcs, kw ? kw->hosts : NULL);
+            stats_phase(stats, "cache_store");
         }
+    }
+    if(dfa)
+        printf("%lu byte classes, transition table has %lu entries\n", dfa->num_classes, dfa->num_states*dfa->num_classes);
 
-        *rootptr = tmp;
-        rootptr = &tmp->or.s2;
+    // renumbered states aren't cached, profiles refer to the cached ones
+    if(prof_file) {
+        prof = profile_load(arena, prof_file, dfa);
+        if(!prof || !profile_apply(arena, prof, dfa))
+            goto exit;
+        stats_phase(stats, "profile_apply");
+        size_t num_hot = 0;
+        for(size_t i = 0; i < dfa->num_states; i++)
+            num_hot += prof->hot[i];
+        printf("states renumbered by profile, %lu of them are hot\n", num_hot);
+    }
 
-        if(!regexp_assoc_ptr(regexp_ptrs, cur, &regexp_funcs[i]))
+    if(engine == ENGINE_TABLE && table == TABLE_COMB) {
+        comb = dfa_comb(arena, dfa, prof ? prof->hot : NULL);
+        if(!comb)
             goto exit;
+        stats_phase(stats, "dfa_comb");
+        size_t dense = dfa->num_states*dfa->num_classes, packed = 2*comb->num_entries + 2*comb->num_states;
+        printf("comb-vector table has %lu entries, %.1f%% of the dense one\n", packed, 100.0*packed/dense);
     }
 
-    tmp = regexp_ext(root);
-    if(!tmp)
-        goto exit;
-    root = tmp;
+    if(kw) {
+        if(!kw_build(arena, kw))
+            goto exit;
+        stats_phase(stats, "kw_build");
+        if(kw->num_folded > 0)
+            printf("%lu keywords moved to %lu perfect hash tables\n", kw->num_folded, kw->num_tables);
+    }
 
-    st = get_regexp_stat(root, regexp_ptrs);
-    if(!st)
+    out = open_memstream(&out_buf, &out_len);
+    if(!out) {
+        perror("open_memstream");
         goto exit;
-
-    dfa = regexp_to_dfa(st);
-    if(!dfa)
+    }
+    gen_h_file(out, trans_units, engine, st);
+    fclose(out);
+    out = NULL;
+    stats_phase(stats, "gen_h_file");
+    if(!write_if_changed(arena, head_file, out_buf, out_len))
         goto exit;
+    out_size += out_len;
+    free(out_buf);
+    out_buf = NULL;
 
-    if(!gen_h_file(head_file, trans_units))
+    out = open_memstream(&out_buf, &out_len);
+    if(!out) {
+        perror("open_memstream");
         goto exit;
-
-    if(!gen_c_file(src_file, head_file, trans_units, regexp_funcs, num_regexp_funcs, dfa))
+    }
+    if(!gen_c_file(out, arena, head_file, dfa_file, trans_units, regexp_funcs, num_regexp_funcs, engine, dfa, comb, prof, st, kw))
         goto exit;
+    fclose(out);
+    out = NULL;
+    stats_phase(stats, "gen_c_file");
+    if(!write_if_changed(arena, src_file, out_buf, out_len))
+        goto exit;
+    out_size += out_len;
+
+    if(engine == ENGINE_MMAP) {
+        free(out_buf);
+        out_buf = NULL;
+        out = open_memstream(&out_buf, &out_len);
+        if(!out) {
+            perror("open_memstream");
+            goto exit;
+        }
+        if(!dfa_file_gen(out, dfa, regexp_funcs, num_regexp_funcs))
+            goto exit;
+        fclose(out);
+        out = NULL;
+        stats_phase(stats, "dfa_file_gen");
+        if(!write_if_changed(arena, dfa_file, out_buf, out_len))
+            goto exit;
+        out_size += out_len;
+    }
+
+    if(stats) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        stats_phase(stats, "write");
+        printf("stats: output %lu bytes\n", out_size);
+        printf("stats: total %.3f ms\n", elapsed_ms(&stats->start, &now));
+    }
 
     ret = 0;
 exit:
-    if(head_file) free(head_file);
-    if(src_file) free(src_file);
+    if(out) fclose(out);
+    if(out_buf) free(out_buf);
     if(trans_units) htable_free(trans_units);
-    if(regexp_funcs) {
-        for(size_t i = 0; i < num_regexp_funcs; i++) {
-            free(regexp_funcs[i].regexp);
-            free(regexp_funcs[i].func);
-        }
-        free(regexp_funcs);
-    }
-    if(regexp_ptrs) htable_free(regexp_ptrs);
-    if(root) syn_tree_free(root);
-    if(st) free_regexp_stat(st);
-    if(dfa) dfa_free(dfa);
+    if(arena) arena_free(arena);
     return ret;
 }
@@ -0,0 +1,126 @@
+#include "posset.h"
+
+#include <string.h>
+
+static bool posset_reserve(arena_t *arena, posset_t *s, size_t max_items) {
+    if(max_items <= s->max_items)
+        return true;
+
+    size_t new_max = s->max_items ? s->max_items : 4;
+    while(new_max < max_items)
+        new_max <<= 1;
+
+    uint32_t *items = arena_realloc(arena, s->items, s->max_items*sizeof(uint32_t), new_max*sizeof(uint32_t));
+    if(!items)
+        return false;
+    s->items = items;
+    s->max_items = new_max;
+    return true;
+}
+
+bool posset_add(arena_t *arena, posset_t *s, uint32_t pos) {
+    size_t lo = 0, hi = s->num_items;
+
+    // positions are mostly added in increasing order
+    if(hi == 0 || s->items[hi-1] < pos) {
+        lo = hi;
+    } else {
+        while(lo < hi) {
+            size_t mid = (lo+hi) >> 1;
+            if(s->items[mid] < pos)
+                lo = mid+1;
+            else
+                hi = mid;
+        }
+        if(s->items[lo] == pos)
+            return true;
+    }
+
+    if(!posset_reserve(arena, s, s->num_items+1))
+        return false;
+    memmove(s->items+lo+1, s->items+lo, (s->num_items-lo)*sizeof(uint32_t));
+    s->items[lo] = pos;
+    s->num_items++;
+    return true;
+}
+
+bool posset_union(arena_t *arena, posset_t *dst, const posset_t *src) {
+    if(src->num_items == 0)
+        return true;
+
+    if(!posset_reserve(arena, dst, dst->num_items+src->num_items))
+        return false;
+
+    if(dst->num_items == 0 || dst->items[dst->num_items-1] < src->items[0]) {
+        memcpy(dst->items+dst->num_items, src->items, src->num_items*sizeof(uint32_t));
+        dst->num_items += src->num_items;
+        return true;
+    }
+
+    // merge from the back, so dst items are moved only once
+    size_t i = dst->num_items, j = src->num_items, k = dst->num_items+src->num_items;
+    while(j > 0) {
+        if(i > 0 && dst->items[i-1] > src->items[j-1]) {
+            dst->items[--k] = dst->items[--i];
+        } else {
+            if(i > 0 && dst->items[i-1] == src->items[j-1])
+                i--;
+            dst->items[--k] = src->items[--j];
+        }
+    }
+
+    // duplicates leave a gap between the merged tail and untouched head
+    if(k != i) {
+        size_t tail = dst->num_items+src->num_items-k;
+        memmove(dst->items+i, dst->items+k, tail*sizeof(uint32_t));
+        dst->num_items = i+tail;
+    } else {
+        dst->num_items += src->num_items;
+    }
+
+    return true;
+}
+
+bool posset_copy(arena_t *arena, posset_t *dst, const posset_t *src) {
+    if(dst->max_items < src->num_items) {
+        uint32_t *items = arena_alloc(arena, src->num_items*sizeof(uint32_t));
+        if(!items)
+            return false;
+        dst->items = items;
+        dst->max_items = src->num_items;
+    }
+    memcpy(dst->items, src->items, src->num_items*sizeof(uint32_t));
+    dst->num_items = src->num_items;
+    return true;
+}
+
+bool posset_eq(const posset_t *s1, const posset_t *s2) {
+    return s1->num_items == s2->num_items &&
+           !memcmp(s1->items, s2->items, s1->num_items*sizeof(uint32_t));
+}
+
+static inline uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32-r));
+}
+
+// murmur3 over position numbers
+uint32_t posset_hash(const posset_t *s) {
+    uint32_t hash = 0x9747b28c;
+    posset_for_each(i, s) {
+        uint32_t k = *i * 0xcc9e2d51;
+        k = rotl32(k, 15) * 0x1b873593;
+        hash ^= k;
+        hash = rotl32(hash, 13)*5 + 0xe6546b64;
+    }
+    hash ^= s->num_items;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+void posset_clear(posset_t *s) {
+    s->num_items = 0;
+}
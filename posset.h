@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+
+// Sorted set of positions without duplicates. Zeroed posset_t is an empty set.
+typedef struct {
+    uint32_t *items;
+    size_t   num_items;
+    size_t   max_items;
+} posset_t;
+
+bool posset_add(arena_t *arena, posset_t *s, uint32_t pos);
+bool posset_union(arena_t *arena, posset_t *dst, const posset_t *src);
+bool posset_copy(arena_t *arena, posset_t *dst, const posset_t *src);
+bool posset_eq(const posset_t *s1, const posset_t *s2);
+uint32_t posset_hash(const posset_t *s);
+void posset_clear(posset_t *s);
+
+#define posset_for_each(var, s) \
+    for(uint32_t *var = (s)->items; var < (s)->items + (s)->num_items; var++)
@@ -0,0 +1,141 @@
+#include "profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the most visited states taking this share of all visits are hot
+#define PROFILE_HOT_SHARE 0.9
+
+typedef struct {
+    uint64_t visits;
+    uint32_t state;
+} state_visits_t;
+
+// FNV-1a of the transition table and targets
+uint64_t profile_dfa_hash(dfa_t *dfa) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t num_entries = dfa->num_states*dfa->num_classes;
+
+    for(size_t i = 0; i < num_entries; i++)
+        hash = (hash ^ dfa->states[i]) * 0x100000001b3ULL;
+    for(size_t i = 0; i < 256; i++)
+        hash = (hash ^ dfa->classes[i]) * 0x100000001b3ULL;
+    for(size_t i = 0; i < dfa->num_states; i++)
+        hash = (hash ^ (dfa->targets[i] != NULL)) * 0x100000001b3ULL;
+    return hash;
+}
+
+// profiles of several runs may be concatenated, their counts are summed
+dfa_profile_t* profile_load(arena_t *arena, const char *filename, dfa_t *dfa) {
+    dfa_profile_t *prof = NULL;
+    unsigned long long count, hash;
+    unsigned long num_states, num_classes;
+    unsigned int s, cls;
+    char line[128];
+    size_t line_num = 0;
+
+    FILE *fd = fopen(filename, "r");
+    if(!fd) {
+        perror(filename);
+        return NULL;
+    }
+
+    prof = arena_calloc(arena, 1, sizeof(dfa_profile_t));
+    if(!prof)
+        goto fail;
+    prof->num_states = dfa->num_states;
+    prof->num_classes = dfa->num_classes;
+    prof->hash = profile_dfa_hash(dfa);
+    prof->visits = arena_calloc(arena, dfa->num_states, sizeof(uint64_t));
+    prof->edges = arena_calloc(arena, dfa->num_states*dfa->num_classes, sizeof(uint64_t));
+    if(!prof->visits || !prof->edges)
+        goto fail;
+
+    while(fgets(line, sizeof(line), fd)) {
+        line_num++;
+        if(sscanf(line, "trans profile %lu %lu %llx", &num_states, &num_classes, &hash) == 3) {
+            if(num_states != dfa->num_states || num_classes != dfa->num_classes || hash != prof->hash) {
+                fprintf(stderr, "%s: profile of another DFA, regenerate it\n", filename);
+                goto fail;
+            }
+        } else if(line_num == 1) {
+            fprintf(stderr, "%s: not a trans profile\n", filename);
+            goto fail;
+        } else if(sscanf(line, "state %u %llu", &s, &count) == 2 && s < dfa->num_states) {
+            prof->visits[s] += count;
+        } else if(sscanf(line, "edge %u %u %llu", &s, &cls, &count) == 3 &&
+                  s < dfa->num_states && cls < dfa->num_classes) {
+            prof->edges[s*dfa->num_classes + cls] += count;
+        } else {
+            fprintf(stderr, "%s:%lu: invalid profile line\n", filename, line_num);
+            goto fail;
+        }
+    }
+    if(ferror(fd)) {
+        perror(filename);
+        goto fail;
+    }
+
+    fclose(fd);
+    return prof;
+fail:
+    fclose(fd);
+    return NULL;
+}
+
+static int visits_cmp(const void *a, const void *b) {
+    const state_visits_t *s1 = a, *s2 = b;
+    if(s1->visits != s2->visits)
+        return s1->visits < s2->visits ? 1 : -1;
+    return s1->state < s2->state ? -1 : s1->state > s2->state;
+}
+
+// states are renumbered by visits, so rows of hot states are adjacent.
+// The start state keeps number 0, it's never a transition target.
+bool profile_apply(arena_t *arena, dfa_profile_t *prof, dfa_t *dfa) {
+    size_t n = dfa->num_states, k = dfa->num_classes;
+    uint64_t total = 0, sum = 0;
+
+    state_visits_t *order = arena_alloc(arena, n*sizeof(state_visits_t));
+    uint32_t *new_num = arena_alloc(arena, n*sizeof(uint32_t));
+    uint32_t *states = arena_alloc(arena, n*k*sizeof(uint32_t));
+    void **targets = arena_alloc(arena, n*sizeof(void*));
+    uint64_t *visits = arena_alloc(arena, n*sizeof(uint64_t));
+    uint64_t *edges = arena_alloc(arena, n*k*sizeof(uint64_t));
+    prof->ids = arena_alloc(arena, n*sizeof(uint32_t));
+    prof->hot = arena_calloc(arena, n, sizeof(bool));
+    if(!order || !new_num || !states || !targets || !visits || !edges || !prof->ids || !prof->hot)
+        return false;
+
+    for(size_t s = 0; s < n; s++) {
+        order[s] = (state_visits_t){ prof->visits[s], s };
+        total += prof->visits[s];
+    }
+    qsort(order + 1, n - 1, sizeof(state_visits_t), visits_cmp);
+    for(size_t s = 0; s < n; s++)
+        new_num[order[s].state] = s;
+
+    for(size_t s = 0; s < n; s++) {
+        size_t old = order[s].state;
+        for(size_t c = 0; c < k; c++)
+            states[s*k + c] = new_num[dfa->states[old*k + c]];
+        targets[s] = dfa->targets[old];
+        visits[s] = prof->visits[old];
+        memcpy(edges + s*k, prof->edges + old*k, k*sizeof(uint64_t));
+        prof->ids[s] = old;
+    }
+
+    // hot states are the most visited ones, the start state included
+    qsort(order, n, sizeof(state_visits_t), visits_cmp);
+    for(size_t i = 0; i < n && order[i].visits && sum < total*PROFILE_HOT_SHARE; i++) {
+        prof->hot[new_num[order[i].state]] = true;
+        sum += order[i].visits;
+    }
+
+    dfa->states = states;
+    dfa->targets = targets;
+    prof->visits = visits;
+    prof->edges = edges;
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "regexp.h"
+
+// Counts written by a lexer compiled with LEXER_PROFILE: how many bytes
+// were read in every state and how many of them were of every class.
+// Profiles refer to states of the DFA as trans builds it, so a lexer
+// generated with a profile writes profiles usable for the next build,
+// and carry a hash of that DFA.
+typedef struct {
+    uint64_t *visits;
+    uint64_t *edges;
+    // after profile_apply: state number before renumbering
+    uint32_t *ids;
+    bool     *hot;
+    size_t   num_states, num_classes;
+    uint64_t hash;
+} dfa_profile_t;
+
+uint64_t profile_dfa_hash(dfa_t *dfa);
+dfa_profile_t* profile_load(arena_t *arena, const char *filename, dfa_t *dfa);
+bool profile_apply(arena_t *arena, dfa_profile_t *prof, dfa_t *dfa);
@@ -3,12 +3,51 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "llist.h"
+#include <limits.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "htable.h"
 
+static inline int charset_count(const charset_t *set) {
+    int n = 0;
+    for(int i = 0; i < 4; i++)
+        n += __builtin_popcountll(set->bits[i]);
+    return n;
+}
+
+static inline void charset_add(charset_t *set, unsigned char c) {
+    set->bits[c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline void charset_add_range(charset_t *set, int from, int to) {
+    for(int c = from; c <= to; c++)
+        charset_add(set, c);
+}
+
 static void __print_syn_tree(syn_tree_t *s) {
     if(s->tag == SYM) {
-        putchar(s->sym.chr);
+        if(charset_count(&s->sym.set) == 1) {
+            for(int c = 0; c < 256; c++) {
+                if(charset_has(&s->sym.set, c))
+                    putchar(c);
+            }
+            return;
+        }
+        putchar('[');
+        for(int c = 0; c < 256; c++) {
+            if(!charset_has(&s->sym.set, c))
+                continue;
+            int to = c;
+            while(to < 255 && charset_has(&s->sym.set, to+1))
+                to++;
+            if(to > c)
+                printf("\\x%02x-\\x%02x", c, to);
+            else
+                printf("\\x%02x", c);
+            c = to;
+        }
+        putchar(']');
     } else if(s->tag == OR) {
         fputs("OR (", stdout);
         __print_syn_tree(s->or.s1);
@@ -21,8 +60,8 @@ static void __print_syn_tree(syn_tree_t *s) {
         fputs(") (", stdout);
         __print_syn_tree(s->and.s2);
         putchar(')');
-    } else if(s->tag == STAR) {
-        fputs("STAR (", stdout);
+    } else if(s->tag == STAR || s->tag == PLUS || s->tag == QUEST) {
+        fputs(s->tag == STAR ? "STAR (" : s->tag == PLUS ? "PLUS (" : "QUEST (", stdout);
         __print_syn_tree(s->star.s);
         putchar(')');
     }
@@ -33,77 +72,488 @@ void print_syn_tree(syn_tree_t *s) {
     putchar('\n');
 }
 
-//static bool all(char c) { return (33 <= c && c <= 126) || c == ' ' || c == '\t' || c == '\n'; }
-static bool nothing(char c) { return false; }
-static bool all(char c) { return true; }
-static bool letter(char c) { return (65 <= c && c <= 90) || (97 <= c && c <= 122); }
-static bool not_letter(char c) { return (33 <= c && c <= 64) || (91 <= c && c <= 96) || (123 <= c && c <= 126); }
-static bool space(char c) { return c == ' ' || c == '\t' || c == '\n'; }
-static bool not_space(char c) { return 33 <= c && c <= 126; }
-static bool digit(char c) { return 48 <= c && c <= 57; }
-static bool not_digit(char c) { return (33 <= c && c <= 47) || (58 <= c && c <= 126); }
+static inline bool sym_match(syn_tree_t *t, int c) {
+    return charset_has(&t->sym.set, c);
+}
+
+// rules ending with a single character win over ones ending with a class
+static inline bool sym_literal(syn_tree_t *t) {
+    return charset_count(&t->sym.set) == 1 && !t->sym.in_class;
+}
+
+// \w, \d, \s and their negations, the negated ones match printable characters only
+static bool escape_class(charset_t *set, char c) {
+    switch(c) {
+        case 'w': charset_add_range(set, 'A', 'Z'); charset_add_range(set, 'a', 'z'); break;
+        case 'W': charset_add_range(set, 33, 64); charset_add_range(set, 91, 96); charset_add_range(set, 123, 126); break;
+        case 's': charset_add(set, ' '); charset_add(set, '\t'); charset_add(set, '\n'); break;
+        case 'S': charset_add_range(set, 33, 126); break;
+        case 'd': charset_add_range(set, '0', '9'); break;
+        case 'D': charset_add_range(set, 33, 47); charset_add_range(set, 58, 126); break;
+        default: return false;
+    }
+    return true;
+}
+
+// character escaped with \, -1 if there is no such escape
+static int escape_char(char c) {
+    switch(c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case '\\': case '.': case '*': case '+': case '?': case '|':
+        case '(': case ')': case '[': case ']': case '^': case '-': case '"':
+            return c;
+    }
+    return -1;
+}
+
+#define UTF8_MAX 0x10ffff
+#define SURROGATE_LO 0xd800
+#define SURROGATE_HI 0xdfff
+
+typedef struct {
+    uint32_t lo, hi;
+} cp_range_t;
+
+static size_t utf8_encode(uint32_t cp, unsigned char *buf) {
+    if(cp < 0x80) {
+        buf[0] = cp;
+        return 1;
+    }
+    if(cp < 0x800) {
+        buf[0] = 0xc0 | cp >> 6;
+        buf[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    }
+    if(cp < 0x10000) {
+        buf[0] = 0xe0 | cp >> 12;
+        buf[1] = 0x80 | (cp >> 6 & 0x3f);
+        buf[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+    buf[0] = 0xf0 | cp >> 18;
+    buf[1] = 0x80 | (cp >> 12 & 0x3f);
+    buf[2] = 0x80 | (cp >> 6 & 0x3f);
+    buf[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+// code point of an ASCII character, UTF-8 sequence or \u{...} escape,
+// -1 if it's malformed. Other escapes are handled by callers.
+static long regexp_char(const char *regexp, size_t len, size_t *char_len) {
+    static const long min_cp[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    const unsigned char *s = (const unsigned char*)regexp;
+    long cp = 0;
+    size_t n;
+
+    if(s[0] == '\\') {
+        for(n = 3; n < len && n < 9 && isxdigit(s[n]); n++)
+            cp = cp*16 + (isdigit(s[n]) ? s[n] - '0' : (s[n] | 0x20) - 'a' + 10);
+        if(len < 4 || s[1] != 'u' || s[2] != '{' || n == 3 || n >= len || s[n] != '}' ||
+           cp > UTF8_MAX || (cp >= SURROGATE_LO && cp <= SURROGATE_HI)) {
+            fputs("Bad \\u{...} escape\n", stderr);
+            return -1;
+        }
+        *char_len = n+1;
+        return cp;
+    }
+
+    if(s[0] < 0x80) {
+        *char_len = 1;
+        return s[0];
+    }
+    n = s[0] >= 0xf0 ? 4 : s[0] >= 0xe0 ? 3 : 2;
+    cp = s[0] & (0x3f >> (n-1));
+    for(size_t i = 1; i < n; i++) {
+        if(i >= len || (s[i] & 0xc0) != 0x80)
+            goto bad;
+        cp = cp << 6 | (s[i] & 0x3f);
+    }
+    if(s[0] < 0xc0 || s[0] > 0xf4 || cp < min_cp[n] || cp > UTF8_MAX || (cp >= SURROGATE_LO && cp <= SURROGATE_HI))
+        goto bad;
+    *char_len = n;
+    return cp;
+bad:
+    fputs("Invalid UTF-8 in regexp\n", stderr);
+    return -1;
+}
+
+static syn_tree_t* sym_range(arena_t *arena, int lo, int hi) {
+    syn_tree_t *t = arena_alloc(arena, sizeof(syn_tree_t));
+    if(!t)
+        return NULL;
+    t->tag = SYM;
+    t->sym.set = (charset_t){{0}};
+    t->sym.in_class = false;
+    charset_add_range(&t->sym.set, lo, hi);
+    return t;
+}
+
+// OR or AND of s1 and s2, just s2 if there is no s1
+static syn_tree_t* tree_join(arena_t *arena, bool is_or, syn_tree_t *s1, syn_tree_t *s2) {
+    if(!s1)
+        return s2;
+    syn_tree_t *t = arena_alloc(arena, sizeof(syn_tree_t));
+    if(!t)
+        return NULL;
+    if(is_or) {
+        t->tag = OR;
+        t->or.s1 = s1;
+        t->or.s2 = s2;
+    } else {
+        t->tag = AND;
+        t->and.s1 = s1;
+        t->and.s2 = s2;
+    }
+    return t;
+}
+
+// bytes in lo[i]..hi[i] one after another
+static syn_tree_t* utf8_seq(arena_t *arena, const unsigned char *lo, const unsigned char *hi, size_t n) {
+    syn_tree_t *t = NULL, *sym;
+    for(size_t i = 0; i < n; i++) {
+        sym = sym_range(arena, lo[i], hi[i]);
+        if(!sym || !(t = tree_join(arena, false, t, sym)))
+            return NULL;
+    }
+    return t;
+}
+
+static syn_tree_t* utf8_char(arena_t *arena, uint32_t cp) {
+    unsigned char buf[4];
+    size_t n = utf8_encode(cp, buf);
+    return utf8_seq(arena, buf, buf, n);
+}
+
+// code points lo..hi are split until every part is a sequence of byte
+// ranges: first where the encoded length changes, then where a range
+// doesn't cover whole blocks of continuation bytes. Surrogates are excluded
+// by callers.
+static bool utf8_range(arena_t *arena, uint32_t lo, uint32_t hi, syn_tree_t **t) {
+    static const uint32_t len_max[] = { 0x7f, 0x7ff, 0xffff };
+    unsigned char lo_buf[4], hi_buf[4];
+    syn_tree_t *seq;
+
+    for(int i = 0; i < 3; i++) {
+        if(lo <= len_max[i] && hi > len_max[i])
+            return utf8_range(arena, lo, len_max[i], t) && utf8_range(arena, len_max[i]+1, hi, t);
+    }
+    for(int i = 1; i < 4; i++) {
+        uint32_t m = (1u << 6*i) - 1;
+        if((lo & ~m) == (hi & ~m))
+            continue;
+        if(lo & m)
+            return utf8_range(arena, lo, lo | m, t) && utf8_range(arena, (lo | m) + 1, hi, t);
+        if((hi & m) != m)
+            return utf8_range(arena, lo, (hi & ~m) - 1, t) && utf8_range(arena, hi & ~m, hi, t);
+    }
+
+    size_t n = utf8_encode(lo, lo_buf);
+    utf8_encode(hi, hi_buf);
+    seq = utf8_seq(arena, lo_buf, hi_buf, n);
+    return seq && (*t = tree_join(arena, true, *t, seq));
+}
+
+static int cp_range_cmp(const void *a, const void *b) {
+    const cp_range_t *r1 = a, *r2 = b;
+    return r1->lo < r2->lo ? -1 : r1->lo > r2->lo;
+}
+
+// ranges are sorted, merged, complemented if negate is set and split
+// around surrogates into out, which has room for num+2 ranges
+static size_t cp_ranges_normalize(cp_range_t *ranges, size_t num, bool negate, cp_range_t *out) {
+    size_t num_merged = 0, num_out = 0;
+    uint32_t next = 0;
+
+    qsort(ranges, num, sizeof(cp_range_t), cp_range_cmp);
+    for(size_t i = 0; i < num; i++) {
+        if(num_merged > 0 && ranges[i].lo <= ranges[num_merged-1].hi + 1) {
+            if(ranges[i].hi > ranges[num_merged-1].hi)
+                ranges[num_merged-1].hi = ranges[i].hi;
+        } else {
+            ranges[num_merged++] = ranges[i];
+        }
+    }
+
+    if(negate) {
+        for(size_t i = 0; i < num_merged; i++) {
+            if(ranges[i].lo > next)
+                out[num_out++] = (cp_range_t){ next, ranges[i].lo - 1 };
+            next = ranges[i].hi + 1;
+        }
+        if(next <= UTF8_MAX)
+            out[num_out++] = (cp_range_t){ next, UTF8_MAX };
+        memcpy(ranges, out, num_out*sizeof(cp_range_t));
+        num_merged = num_out;
+    }
+
+    num_out = 0;
+    for(size_t i = 0; i < num_merged; i++) {
+        cp_range_t r = ranges[i];
+        if(r.hi < SURROGATE_LO || r.lo > SURROGATE_HI) {
+            out[num_out++] = r;
+            continue;
+        }
+        if(r.lo < SURROGATE_LO)
+            out[num_out++] = (cp_range_t){ r.lo, SURROGATE_LO - 1 };
+        if(r.hi > SURROGATE_HI)
+            out[num_out++] = (cp_range_t){ SURROGATE_HI + 1, r.hi };
+    }
+    return num_out;
+}
+
+static void mark_class(syn_tree_t *t) {
+    if(t->tag == SYM) {
+        t->sym.in_class = true;
+    } else if(t->tag == OR) {
+        mark_class(t->or.s1);
+        mark_class(t->or.s2);
+    } else {
+        mark_class(t->and.s1);
+        mark_class(t->and.s2);
+    }
+}
+
+// ASCII characters of a code point class are one SYM, the others are
+// alternatives of UTF-8 byte sequences
+static syn_tree_t* cp_class_tree(arena_t *arena, const charset_t *ascii, cp_range_t *ranges, size_t num_ranges, bool negate) {
+    cp_range_t *norm = arena_alloc(arena, (num_ranges + 64 + 2)*sizeof(cp_range_t));
+    charset_t low = {{0}};
+    syn_tree_t *t = NULL, *sym;
+    size_t num_norm;
+
+    if(!norm)
+        return NULL;
+    for(int c = 0; c < 128; c++) {
+        if(!charset_has(ascii, c))
+            continue;
+        if(num_ranges > 0 && ranges[num_ranges-1].hi + 1 == (uint32_t)c)
+            ranges[num_ranges-1].hi = c;
+        else
+            ranges[num_ranges++] = (cp_range_t){ c, c };
+    }
+    num_norm = cp_ranges_normalize(ranges, num_ranges, negate, norm);
+
+    for(size_t i = 0; i < num_norm; i++) {
+        if(norm[i].lo < 0x80)
+            charset_add_range(&low, norm[i].lo, norm[i].hi < 0x80 ? norm[i].hi : 0x7f);
+        if(norm[i].hi >= 0x80 && !utf8_range(arena, norm[i].lo < 0x80 ? 0x80 : norm[i].lo, norm[i].hi, &t))
+            return NULL;
+    }
+    if(charset_count(&low) > 0) {
+        if(!(sym = arena_alloc(arena, sizeof(syn_tree_t))))
+            return NULL;
+        sym->tag = SYM;
+        sym->sym.set = low;
+        t = tree_join(arena, true, t, sym);
+    } else if(!t) {
+        fputs("[ ] matches nothing\n", stderr);
+    }
+    if(t)
+        mark_class(t);
+    return t;
+}
+
+// adds lo..hi to a class: ASCII characters to its byte set,
+// the others to its code point ranges
+static void class_add(charset_t *cls, cp_range_t *ranges, size_t *num_ranges, long lo, long hi) {
+    if(lo < 0x80)
+        charset_add_range(cls, lo, hi < 0x80 ? hi : 0x7f);
+    if(hi >= 0x80)
+        ranges[(*num_ranges)++] = (cp_range_t){ lo < 0x80 ? 0x80 : lo, hi };
+}
+
+// [abc], [a-z], [^...], escapes are allowed inside. A class with \u{...}
+// or non-ASCII characters matches code points and is compiled into UTF-8
+// byte sequences, other classes match bytes.
+static syn_tree_t* parse_class(arena_t *arena, const char *regexp, size_t len, size_t *off) {
+    charset_t cls = {{0}};
+    cp_range_t *ranges;
+    syn_tree_t *t;
+    size_t i = 1, num_ranges = 0, chr_len;
+    bool negate = false, unicode = false;
+    long prev = -1, chr, to;
+
+    // every character adds at most one range, ASCII ones are added at the end
+    ranges = arena_alloc(arena, (len + 64)*sizeof(cp_range_t));
+    if(!ranges)
+        return NULL;
+
+    if(i < len && regexp[i] == '^') {
+        negate = true;
+        i++;
+    }
+
+    for(;;) {
+        if(i >= len) {
+            fputs("[ is unclosed\n", stderr);
+            return NULL;
+        }
+
+        char c = regexp[i];
+        if(c == ']' && (i > 1+negate)) {
+            i++;
+            break;
+        }
+
+        if(c == '\\' && i+1 >= len) {
+            fputs("\\ at the end of regexp\n", stderr);
+            return NULL;
+        }
+        if(c == '\\' && regexp[i+1] != 'u') {
+            if(escape_class(&cls, regexp[i+1])) {
+                prev = -1;
+                i += 2;
+                continue;
+            }
+            if((chr = escape_char(regexp[i+1])) < 0) {
+                fprintf(stderr, "\\%c is unexpected control character\n", regexp[i+1]);
+                return NULL;
+            }
+            i += 2;
+        } else if(c == '-' && prev >= 0 && i+1 < len && regexp[i+1] != ']') {
+            if(regexp[i+1] == '\\' && (i+2 >= len || regexp[i+2] != 'u')) {
+                if(i+2 >= len || (to = escape_char(regexp[i+2])) < 0) {
+                    fputs("Bad end of range in [ ]\n", stderr);
+                    return NULL;
+                }
+                chr_len = 2;
+            } else {
+                if((to = regexp_char(regexp+i+1, len-i-1, &chr_len)) < 0)
+                    return NULL;
+                unicode = unicode || regexp[i+1] == '\\' || to >= 0x80;
+            }
+            if(to < prev) {
+                if(prev < 0x80)
+                    fprintf(stderr, "Bad range %c-%c\n", (int)prev, (int)to);
+                else
+                    fprintf(stderr, "Bad range \\u{%lx}-\\u{%lx}\n", prev, to);
+                return NULL;
+            }
+            class_add(&cls, ranges, &num_ranges, prev, to);
+            prev = -1;
+            i += 1 + chr_len;
+            continue;
+        } else {
+            if((chr = regexp_char(regexp+i, len-i, &chr_len)) < 0)
+                return NULL;
+            unicode = unicode || c == '\\' || chr >= 0x80;
+            i += chr_len;
+        }
+
+        class_add(&cls, ranges, &num_ranges, chr, chr);
+        prev = chr;
+    }
+    *off = i;
+
+    if(unicode)
+        return cp_class_tree(arena, &cls, ranges, num_ranges, negate);
+
+    if(negate) {
+        for(int w = 0; w < 4; w++)
+            cls.bits[w] = ~cls.bits[w];
+    }
+    if(charset_count(&cls) == 0) {
+        fputs("[ ] matches nothing\n", stderr);
+        return NULL;
+    }
+    if(!(t = arena_alloc(arena, sizeof(syn_tree_t))))
+        return NULL;
+    t->tag = SYM;
+    t->sym.set = cls;
+    t->sym.in_class = false;
+    return t;
+}
+
+// *, + or ? after a symbol or brackets
+static syn_tree_t* parse_postfix(arena_t *arena, syn_tree_t *t, const char *regexp, size_t len, size_t *off, bool *error) {
+    *error = false;
+    if(len == 0 || (regexp[0] != '*' && regexp[0] != '+' && regexp[0] != '?'))
+        return t;
+
+    if(len > 1 && (regexp[1] == '*' || regexp[1] == '+' || regexp[1] == '?')) {
+        fprintf(stderr, "%c is unexpected\n", regexp[1]);
+        goto exit;
+    }
 
-syn_tree_t* parse_sym(const char *regexp, size_t len, size_t *off, bool *error) {
+    syn_tree_t *st = arena_alloc(arena, sizeof(syn_tree_t));
+    if(!st)
+        goto exit;
+    st->tag = regexp[0] == '*' ? STAR : regexp[0] == '+' ? PLUS : QUEST;
+    st->star.s = t;
+    (*off)++;
+    return st;
+exit:
+    *error = true;
+    return NULL;
+}
+
+syn_tree_t* parse_sym(arena_t *arena, const char *regexp, size_t len, size_t *off, bool *error) {
     syn_tree_t *t = NULL;
     size_t v_off;
+    long chr;
 
     *error = false;
     if(len == 0) return NULL;
 
     if((regexp[0] >= 33 && regexp[0] <= 39)   ||
-       (regexp[0] >= 43 && regexp[0] <= 45)   ||
-       (regexp[0] >= 47 && regexp[0] <= 91)   ||
+       (regexp[0] >= 44 && regexp[0] <= 62)   ||
+       (regexp[0] >= 64 && regexp[0] <= 90)   ||
        (regexp[0] >= 93 && regexp[0] <= 123)  ||
        (regexp[0] == 125 || regexp[0] == 126) ||
+       (unsigned char)regexp[0] >= 0x80       ||
+       regexp[0] == '[' ||
        (len >= 2 && regexp[0] == '\\'))
     {
-        t = malloc(sizeof(syn_tree_t));
-        if(!t) {
-            perror("malloc");
+        if(regexp[0] == ']') {
+            fputs("] is unexpected\n", stderr);
             goto exit;
         }
 
-        t->sym.pred = NULL;
-        t->tag = SYM;
-
-        if(regexp[0] == '\\') {
-            switch(regexp[1]) {
-                case 'w':  t->sym.chr = 'w'; t->sym.pred = letter;     break;
-                case 'W':  t->sym.chr = 'W'; t->sym.pred = not_letter; break;
-                case 's':  t->sym.chr = 's'; t->sym.pred = space;      break;
-                case 'S':  t->sym.chr = 'S'; t->sym.pred = not_space;  break;
-                case 'd':  t->sym.chr = 'd'; t->sym.pred = digit;      break;
-                case 'D':  t->sym.chr = 'D'; t->sym.pred = not_digit;  break;
-                case '\\': case '.': case '*': case '|': case '(': case ')': case '"': t->sym.chr = regexp[1]; break;
-                default:
-                    fprintf(stderr, "\\%c is unexpected control character\n", regexp[1]);
-                    goto exit;
-            }
-            v_off = 2;
+        // a non-ASCII character is a sequence of bytes, postfix
+        // operators apply to all of them
+        if((unsigned char)regexp[0] >= 0x80 || (regexp[0] == '\\' && regexp[1] == 'u')) {
+            if((chr = regexp_char(regexp, len, &v_off)) < 0)
+                goto exit;
+            t = utf8_char(arena, chr);
+            if(!t)
+                goto exit;
+        } else if(regexp[0] == '[') {
+            t = parse_class(arena, regexp, len, &v_off);
+            if(!t)
+                goto exit;
         } else {
-            t->sym.chr = regexp[0];
-            v_off = 1;
-            if(regexp[0] == '.')
-                t->sym.pred = all;
-        }
-
-        if(len > v_off && regexp[v_off] == '*') {
-            if(len > v_off+1 && regexp[v_off+1] == '*') {
-                fputs("* is unexpected\n", stderr);
+            t = arena_alloc(arena, sizeof(syn_tree_t));
+            if(!t)
                 goto exit;
-            }
 
-            syn_tree_t *st = malloc(sizeof(syn_tree_t));
-            if(!st) {
-                perror("malloc");
-                goto exit;
+            t->tag = SYM;
+            t->sym.set = (charset_t){{0}};
+            t->sym.in_class = false;
+
+            if(regexp[0] == '\\') {
+                if(!escape_class(&t->sym.set, regexp[1])) {
+                    if((chr = escape_char(regexp[1])) < 0) {
+                        fprintf(stderr, "\\%c is unexpected control character\n", regexp[1]);
+                        goto exit;
+                    }
+                    charset_add(&t->sym.set, chr);
+                }
+                v_off = 2;
+            } else if(regexp[0] == '.') {
+                charset_add_range(&t->sym.set, 0, 255);
+                v_off = 1;
+            } else {
+                charset_add(&t->sym.set, regexp[0]);
+                v_off = 1;
             }
-            v_off++;
-            st->tag = STAR;
-            st->star.s = t;
-            t = st;
         }
 
+        t = parse_postfix(arena, t, regexp+v_off, len-v_off, &v_off, error);
+        if(*error)
+            goto exit;
+
         *off = v_off;
         return t;
     }
@@ -111,11 +561,10 @@ syn_tree_t* parse_sym(const char *regexp, size_t len, size_t *off, bool *error)
     return NULL;
 exit:
     *error = true;
-    if(t) free(t);
     return NULL;
 }
 
-syn_tree_t* parse_brackets(const char *regexp, size_t len, size_t *off, bool *error) {
+syn_tree_t* parse_brackets(arena_t *arena, const char *regexp, size_t len, size_t *off, bool *error) {
     syn_tree_t *t = NULL;
     int nested = 1;
     size_t i;
@@ -124,7 +573,21 @@ syn_tree_t* parse_brackets(const char *regexp, size_t len, size_t *off, bool *er
     if(len == 0 || regexp[0] != '(') return NULL;
 
     for(i = 1; i < len; i++) {
-        if(regexp[i] == '(') {
+        if(regexp[i] == '\\') {
+            i++;
+        } else if(regexp[i] == '[') {
+            // brackets inside a character class aren't counted
+            size_t j = i+1;
+            if(j < len && regexp[j] == '^')
+                j++;
+            if(j < len && regexp[j] == ']')
+                j++;
+            for( ; j < len && regexp[j] != ']'; j++) {
+                if(regexp[j] == '\\')
+                    j++;
+            }
+            i = j;
+        } else if(regexp[i] == '(') {
             nested++;
         } else if(regexp[i] == ')') {
             nested--;
@@ -142,47 +605,32 @@ syn_tree_t* parse_brackets(const char *regexp, size_t len, size_t *off, bool *er
         goto exit;
     }
 
-    t = parse_regexp(regexp+1, i-1, off, error);
+    t = parse_regexp(arena, regexp+1, i-1, off, error);
     if(*error || !t)
         goto exit;
     
     i++;
-    if(len > i && regexp[i] == '*') {
-        if(len > i+1 && regexp[i+1] == '*') {
-            fputs("* is unexpected\n", stderr);
-            goto exit;
-        }
-
-        syn_tree_t *st = malloc(sizeof(syn_tree_t));
-        if(!st) {
-            perror("malloc");
-            goto exit;
-        }
-
-        st->tag = STAR;
-        st->star.s = t;
-        t = st;
-        i++;
-    }
+    t = parse_postfix(arena, t, regexp+i, len-i, &i, error);
+    if(*error)
+        goto exit;
 
     *off = i;
     return t;
 exit:
     *error = true;
-    if(t) syn_tree_free(t);
     return NULL;
 }
 
-syn_tree_t* parse_regexp(const char *regexp, size_t len, size_t *off, bool *error) {
+syn_tree_t* parse_regexp(arena_t *arena, const char *regexp, size_t len, size_t *off, bool *error) {
     syn_tree_t *t = NULL, *tmp;
     size_t v_off = 0, bak_len = len;
 
     while(len > 0) {
-        tmp = parse_brackets(regexp, len, off, error);
+        tmp = parse_brackets(arena, regexp, len, off, error);
         if(*error)
             goto exit;
         if(!tmp) {
-            tmp = parse_sym(regexp, len, off, error);
+            tmp = parse_sym(arena, regexp, len, off, error);
             if(*error)
                 goto exit;
             if(!tmp) {
@@ -201,10 +649,9 @@ syn_tree_t* parse_regexp(const char *regexp, size_t len, size_t *off, bool *erro
             t = tmp;
 
         if(len > 0) {
-            syn_tree_t *st = malloc(sizeof(syn_tree_t));
+            syn_tree_t *st = arena_alloc(arena, sizeof(syn_tree_t));
             if(!st) {
                 *error = true;
-                perror("malloc");
                 goto exit;
             }
 
@@ -214,7 +661,7 @@ syn_tree_t* parse_regexp(const char *regexp, size_t len, size_t *off, bool *erro
 
                 st->tag = OR;
                 st->or.s1 = t;
-                st->or.s2 = parse_regexp(regexp, len, off, error);
+                st->or.s2 = parse_regexp(arena, regexp, len, off, error);
                 t = st;
 
                 if(*error || !st->or.s2)
@@ -235,57 +682,30 @@ syn_tree_t* parse_regexp(const char *regexp, size_t len, size_t *off, bool *erro
     *off = bak_len-len;
     return t;
 exit:
-    if(t) syn_tree_free(t);
     return NULL;
 }
 
-void syn_tree_free(syn_tree_t *s) {
-    if(s->tag == OR) {
-        syn_tree_free(s->or.s1);
-        if(s->or.s2) syn_tree_free(s->or.s2);
-    } else if(s->tag == AND) {
-        syn_tree_free(s->and.s1);
-        if(s->and.s2) syn_tree_free(s->and.s2);
-    } else if(s->tag == STAR) {
-        syn_tree_free(s->star.s);
-    }
-    free(s);
-}
-
 #define MIN_FOLLOWPOS_SIZE 30
 
-static inline sym_node_t* sym_node_create(syn_tree_t *t, size_t ind) {
-    sym_node_t *n = malloc(sizeof(sym_node_t));
-    if(!n) {
-        perror("malloc");
-        return NULL;
+// split every byte class into bytes matched and not matched by t
+static void refine_classes(regexp_stat *st, syn_tree_t *t) {
+    short split[256][2];
+    size_t num_classes = 0;
+
+    memset(split, -1, sizeof(split));
+    for(int c = 0; c < 256; c++) {
+        unsigned char cls = st->classes[c];
+        bool in = sym_match(t, c);
+        if(split[cls][in] < 0)
+            split[cls][in] = num_classes++;
+        st->classes[c] = split[cls][in];
     }
-    n->t = t;
-    n->ind = ind;
-    return n;
-}
-
-static node_t* sym_node_copy(node_t *_src) {
-    sym_node_t *src = (sym_node_t*)_src;
-    return (node_t*)sym_node_create(src->t, src->ind);
+    st->num_classes = num_classes;
 }
 
 static bool get_tree_stat(syn_tree_t *t, regexp_stat *st) {
+    posset_t fps1, lps1;
     bool ns1;
-    list_t *fps1, *lps1;
-
-    if(st->num_syms >= st->max_syms && (t->tag == AND || t->tag == STAR)) {
-        size_t from = st->max_syms;
-        st->max_syms <<= 1;
-        list_t **new_follow = realloc(st->followpos, st->max_syms*sizeof(list_t*));
-        if(!new_follow) {
-            perror("realloc");
-            return false;
-        }
-        st->followpos = new_follow;
-        for(size_t i = from; i < st->max_syms; i++)
-            st->followpos[i] = NULL;
-    }
 
     if(t->tag == AND) {
         if(!get_tree_stat(t->and.s1, st))
@@ -297,32 +717,19 @@ static bool get_tree_stat(syn_tree_t *t, regexp_stat *st) {
         if(!get_tree_stat(t->and.s2, st))
             return false;
 
-        list_for_each(i, sym_node_t, lps1) {
-            size_t ind = i->ind;
-            list_t *cpy = list_copy(st->firstpos);
-            if(!cpy)
+        posset_for_each(i, &lps1) {
+            if(!posset_union(st->arena, &st->followpos[*i], &st->firstpos))
                 return false;
-            if(!st->followpos[ind]) {
-                st->followpos[ind] = list_create(sym_node_copy, NULL);
-                if(!st->followpos[ind]) {
-                    list_free(cpy);
-                    return false;
-                }
-            }
-            st->followpos[ind] = list_union(st->followpos[ind], cpy);
         }
 
-        if(ns1) {
-            st->firstpos = list_union(fps1, st->firstpos);
-        } else {
-            list_free(st->firstpos);
-            st->firstpos = fps1;
-        }
+        if(ns1 && !posset_union(st->arena, &fps1, &st->firstpos))
+            return false;
+        st->firstpos = fps1;
 
         if(st->nullable) {
-            st->lastpos = list_union(st->lastpos, lps1);
-        } else {
-            list_free(lps1);
+            if(!posset_union(st->arena, &lps1, &st->lastpos))
+                return false;
+            st->lastpos = lps1;
         }
 
         st->nullable = ns1 && st->nullable;
@@ -336,46 +743,48 @@ static bool get_tree_stat(syn_tree_t *t, regexp_stat *st) {
         if(!get_tree_stat(t->or.s2, st))
             return false;
 
-        st->firstpos = list_union(fps1, st->firstpos);
-        st->lastpos = list_union(lps1, st->lastpos);
+        if(!posset_union(st->arena, &fps1, &st->firstpos) || !posset_union(st->arena, &lps1, &st->lastpos))
+            return false;
+        st->firstpos = fps1;
+        st->lastpos = lps1;
         st->nullable = st->nullable || ns1;
     } else if(t->tag == SYM) {
-        st->firstpos = list_create(sym_node_copy, NULL);
-        if(!st->firstpos)
-            return false;
-        sym_node_t *n = sym_node_create(t, st->num_syms);
-        if(!n)
-            return false;
-        list_append(st->firstpos, n);
+        if(st->num_syms == st->max_syms) {
+            size_t max_syms = st->max_syms << 1;
+            posset_t *new_follow = arena_realloc(st->arena, st->followpos, st->max_syms*sizeof(posset_t), max_syms*sizeof(posset_t));
+            if(!new_follow)
+                return false;
+            memset(new_follow + st->max_syms, 0, (max_syms-st->max_syms)*sizeof(posset_t));
+            st->followpos = new_follow;
 
-        st->lastpos = list_create(sym_node_copy, NULL);
-        if(!st->lastpos)
-            return false;
-        n = sym_node_create(t, st->num_syms);
-        if(!n)
+            syn_tree_t **new_syms = arena_realloc(st->arena, st->syms, st->max_syms*sizeof(syn_tree_t*), max_syms*sizeof(syn_tree_t*));
+            if(!new_syms)
+                return false;
+            st->syms = new_syms;
+            st->max_syms = max_syms;
+        }
+
+        st->syms[st->num_syms] = t;
+        st->firstpos = st->lastpos = (posset_t){0};
+        if(!posset_add(st->arena, &st->firstpos, st->num_syms) || !posset_add(st->arena, &st->lastpos, st->num_syms))
             return false;
-        list_append(st->lastpos, n);
         st->nullable = false;
         st->num_syms++;
-    } else if(t->tag == STAR) {
+        refine_classes(st, t);
+    } else if(t->tag == STAR || t->tag == PLUS) {
         if(!get_tree_stat(t->star.s, st))
             return false;
 
-        list_for_each(i, sym_node_t, st->lastpos) {
-            size_t ind = i->ind;
-            list_t *cpy = list_copy(st->firstpos);
-            if(!cpy)
+        posset_for_each(i, &st->lastpos) {
+            if(!posset_union(st->arena, &st->followpos[*i], &st->firstpos))
                 return false;
-            if(!st->followpos[ind]) {
-                st->followpos[ind] = list_create(sym_node_copy, NULL);
-                if(!st->followpos[ind]) {
-                    list_free(cpy);
-                    return false;
-                }
-            }
-            st->followpos[ind] = list_union(st->followpos[ind], cpy);
         }
 
+        if(t->tag == STAR)
+            st->nullable = true;
+    } else if(t->tag == QUEST) {
+        if(!get_tree_stat(t->quest.s, st))
+            return false;
         st->nullable = true;
     } else {
         return false;
@@ -384,37 +793,9 @@ static bool get_tree_stat(syn_tree_t *t, regexp_stat *st) {
     return true;
 }
 
-syn_tree_t* regexp_ext(syn_tree_t *s1) {
-    syn_tree_t *a = NULL, *s2 = NULL;
-
-    a = malloc(sizeof(syn_tree_t));
-    if(!a) {
-        perror("malloc");
-        goto exit;
-    }
-
-    s2 = malloc(sizeof(syn_tree_t));
-    if(!s2) {
-        perror("malloc");
-        goto exit;
-    }
-    s2->tag = SYM;
-    s2->sym.chr = 0;
-    s2->sym.pred = nothing;
-
-    a->tag = AND;
-    a->and.s1 = s1;
-    a->and.s2 = s2;
-    return a;
-exit:
-    if(a) free(a);
-    if(s2) free(s2);
-    return NULL;
-}
-
 static uint32_t sym_ptr_hash(hnode_t *_n) {
     sym_ptr_t *n = (sym_ptr_t*)_n;
-    return ((unsigned long)n->s) & 0xffffffff;
+    return ptr_hash_func(n->s);
 }
 
 static bool sym_ptr_keyeq(hnode_t *_n1, hnode_t *_n2) {
@@ -423,85 +804,81 @@ static bool sym_ptr_keyeq(hnode_t *_n1, hnode_t *_n2) {
     return n1->s == n2->s;
 }
 
-regexp_stat* get_regexp_stat(syn_tree_t *ext, htable_t *regexp_ptrs) {
-    regexp_stat *st = malloc(sizeof(regexp_stat));
-    if(!st) {
-        perror("malloc");
-        goto exit;
+static void* sym_target(regexp_stat *st, size_t pos) {
+    sym_ptr_t key_node, *found_node;
+    key_node.s = st->syms[pos];
+    found_node = (sym_ptr_t*)htable_lookup(st->regexp_ptrs, (hnode_t*)&key_node);
+    if(!found_node) {
+        fputs("Internal error: position without target\n", stderr);
+        return NULL;
     }
+    return found_node->ptr;
+}
+
+regexp_stat* get_regexp_stat(arena_t *arena, syn_tree_t *root, htable_t *regexp_ptrs) {
+    regexp_stat *st = arena_calloc(arena, 1, sizeof(regexp_stat));
+    if(!st)
+        return NULL;
 
+    st->arena = arena;
     st->max_syms = MIN_FOLLOWPOS_SIZE;
     st->num_syms = 0;
     st->regexp_ptrs = regexp_ptrs;
-    st->followpos = calloc(st->max_syms, sizeof(list_t*));
-    if(!st->followpos) {
-        perror("calloc");
-        goto exit;
-    }
+    memset(st->classes, 0, sizeof(st->classes));
+    st->num_classes = 1;
+    st->followpos = arena_calloc(arena, st->max_syms, sizeof(posset_t));
+    if(!st->followpos)
+        return NULL;
+    st->syms = arena_alloc(arena, st->max_syms*sizeof(syn_tree_t*));
+    if(!st->syms)
+        return NULL;
 
-    syn_tree_t *s1 = ext->and.s1;
-    syn_tree_t *s2 = ext->and.s2;
-    if(!get_tree_stat(s1, st))
-        goto exit;
+    if(!get_tree_stat(root, st))
+        return NULL;
 
-    if(st->max_syms < st->num_syms) {
-        size_t from = st->max_syms, to = st->num_syms;
-        st->max_syms = st->num_syms;
-        list_t **tmp = realloc(st->followpos, sizeof(list_t*)*st->max_syms);
-        if(!tmp) {
-            perror("realloc");
-            goto exit;
+    st->sym_classes = arena_calloc(arena, st->num_syms, sizeof(*st->sym_classes));
+    if(!st->sym_classes)
+        return NULL;
+    for(size_t i = 0; i < st->num_syms; i++) {
+        for(int c = 0; c < 256; c++) {
+            unsigned char cls = st->classes[c];
+            if(sym_match(st->syms[i], c))
+                st->sym_classes[i][cls >> 6] |= 1ULL << (cls & 63);
         }
-        st->followpos = tmp;
-        for( ; from < to; from++)
-            st->followpos[from] = NULL;
     }
 
-    size_t end_ind = st->num_syms;
+    // positions of one rule are numbered contiguously, so a rule starts
+    // whenever the target changes
+    size_t num_rules = 0, rule = 0;
     void *prev_target = NULL, *cur_target;
-    sym_ptr_t key_node, *found_node;
-    list_for_each(i, sym_node_t, st->lastpos) {
-        size_t ind = i->ind;
+    posset_for_each(i, &st->lastpos) {
+        cur_target = sym_target(st, *i);
+        if(!cur_target)
+            return NULL;
+        if(cur_target != prev_target)
+            num_rules++;
+        prev_target = cur_target;
+    }
 
-        key_node.s = i->t;
-        found_node = (sym_ptr_t*)htable_lookup(regexp_ptrs, (hnode_t*)&key_node);
-        if(!found_node)
-            goto exit;
-        cur_target = found_node->ptr;
+    st->num_ends = num_rules*2;
+    st->end_targets = arena_calloc(arena, st->num_ends, sizeof(void*));
+    if(!st->end_targets)
+        return NULL;
 
+    prev_target = NULL;
+    posset_for_each(i, &st->lastpos) {
+        cur_target = sym_target(st, *i);
         if(prev_target && prev_target != cur_target)
-            end_ind++;
-
-        sym_node_t *newnode = sym_node_create(s2, end_ind);
-        if(!newnode)
-            goto exit;
-        if(!st->followpos[ind]) {
-            st->followpos[ind] = list_create(sym_node_copy, NULL);
-            if(!st->followpos[ind]) {
-                free(newnode);
-                goto exit;
-            }
-        }
-        list_append(st->followpos[ind], newnode);
+            rule++;
         prev_target = cur_target;
+
+        size_t end = sym_literal(st->syms[*i]) ? rule : num_rules + rule;
+        st->end_targets[end] = cur_target;
+        if(!posset_add(arena, &st->followpos[*i], st->num_syms + end))
+            return NULL;
     }
 
     return st;
-exit:
-    free_regexp_stat(st);
-    return NULL;
-}
-
-void free_regexp_stat(regexp_stat *st) {
-    if(st->firstpos) list_free(st->firstpos);
-    if(st->lastpos) list_free(st->lastpos);
-    if(st->followpos) {
-        for(size_t i = 0; i < st->max_syms; i++)
-            if(st->followpos[i])
-                list_free(st->followpos[i]);
-        if(st->followpos) free(st->followpos);
-    }
-    free(st);
 }
 
 htable_t* sym_ptr_htable_init() {
@@ -513,7 +890,7 @@ bool regexp_assoc_ptr(htable_t *htable, syn_tree_t *s, void *ptr) {
         return regexp_assoc_ptr(htable, s->and.s1, ptr) && regexp_assoc_ptr(htable, s->and.s2, ptr);
     } else if(s->tag == OR) {
         return regexp_assoc_ptr(htable, s->or.s1, ptr) && regexp_assoc_ptr(htable, s->or.s2, ptr);
-    } else if(s->tag == STAR) {
+    } else if(s->tag == STAR || s->tag == PLUS || s->tag == QUEST) {
         return regexp_assoc_ptr(htable, s->star.s, ptr);
     } else if(s->tag == SYM) {
         sym_ptr_t key_node;
@@ -524,215 +901,556 @@ bool regexp_assoc_ptr(htable_t *htable, syn_tree_t *s, void *ptr) {
     return false;
 }
 
-static inline state_node_t* state_node_create(list_t *state) {
-    state_node_t *n = malloc(sizeof(state_node_t));
-    if(!n) {
-        perror("malloc");
-        return NULL;
-    }
-    n->state = state;
-    return n;
+static uint32_t state_int_hash(hnode_t *_n) {
+    state_int_t *n = (state_int_t*)_n;
+    return posset_hash(&n->state);
 }
 
-static void state_node_free(node_t *_n) {
-    state_node_t *n = (state_node_t*)_n;
-    list_free(n->state);
+static bool state_int_keyeq(hnode_t *_n1, hnode_t *_n2) {
+    state_int_t *n1 = (state_int_t*)_n1;
+    state_int_t *n2 = (state_int_t*)_n2;
+    return posset_eq(&n1->state, &n2->state);
 }
 
-static uint32_t state_int_hash(hnode_t *_n) {
-    state_int_t *n = (state_int_t*)_n;
-    uint32_t hash = 0;
-    uint32_t base = 1;
-    list_for_each(i, sym_node_t, n->state) {
-        hash += i->ind * base;
-        base *= 10;
+// the smallest end marker of a state selects its target
+static void* state_target(regexp_stat *st, posset_t *state) {
+    size_t lo = 0, hi = state->num_items;
+    while(lo < hi) {
+        size_t mid = (lo+hi) >> 1;
+        if(state->items[mid] < st->num_syms)
+            lo = mid+1;
+        else
+            hi = mid;
     }
-    return hash;
+    return lo < state->num_items ? st->end_targets[state->items[lo] - st->num_syms] : NULL;
 }
 
-static bool state_int_keyeq(hnode_t *_n1, hnode_t *_n2) {
-    state_node_t *n1 = (state_node_t*)_n1;
-    state_node_t *n2 = (state_node_t*)_n2;
-    sym_node_t *i = (sym_node_t*)n1->state->first;
-    sym_node_t *j = (sym_node_t*)n2->state->first;
-    bool is_eq = true;
-
-    while(i != NULL || j != NULL) {
-        if(((i == NULL || j == NULL) && i != j) || i->ind != j->ind) {
-            is_eq = false;
+static inline bool dfa_target_insert(arena_t *arena, dfa_t *dfa, void *target) {
+    if(dfa->num_targets == dfa->max_targets) {
+        void **newtargets = arena_realloc(arena, dfa->targets, sizeof(void*)*dfa->max_targets, sizeof(void*)*(dfa->max_targets<<1));
+        if(!newtargets)
+            return false;
+        dfa->targets = newtargets;
+        dfa->max_targets <<= 1;
+    }
+    dfa->targets[dfa->num_targets++] = target;
+    return true;
+}
+
+static bool dfa_states_reserve(arena_t *arena, dfa_t *dfa, size_t max_states) {
+    if(max_states <= dfa->max_states)
+        return true;
+
+    uint32_t *newstates = arena_realloc(arena, dfa->states,
+                                        sizeof(uint32_t)*dfa->max_states*dfa->num_classes,
+                                        sizeof(uint32_t)*max_states*dfa->num_classes);
+    if(!newstates)
+        return false;
+    memset(newstates + dfa->max_states*dfa->num_classes, 0,
+           sizeof(uint32_t)*(max_states-dfa->max_states)*dfa->num_classes);
+    dfa->states = newstates;
+    dfa->max_states = max_states;
+    return true;
+}
+
+typedef struct {
+    arena_t     *arena;
+    regexp_stat *st;
+    dfa_t       *dfa;
+    posset_t    *states;
+    htable_t    *htable;
+} dfa_build_t;
+
+// union of followpos of every position of state matching the class,
+// bits must be zeroed and are left zeroed
+static bool dfa_successor(arena_t *arena, regexp_stat *st, uint64_t *bits, posset_t *state, size_t cls, posset_t *newstate) {
+    size_t lo = SIZE_MAX, hi = 0;
+
+    posset_clear(newstate);
+    posset_for_each(i, state) {
+        if(*i >= st->num_syms)
             break;
+        if(!(st->sym_classes[*i][cls >> 6] & (1ULL << (cls & 63))))
+            continue;
+
+        posset_t *follow = &st->followpos[*i];
+        if(follow->num_items == 0)
+            continue;
+        posset_for_each(j, follow)
+            bits[*j >> 6] |= 1ULL << (*j & 63);
+        if((follow->items[0] >> 6) < lo)
+            lo = follow->items[0] >> 6;
+        if((follow->items[follow->num_items-1] >> 6) > hi)
+            hi = follow->items[follow->num_items-1] >> 6;
+    }
+
+    for(size_t w = lo; w <= hi; w++) {
+        while(bits[w]) {
+            uint32_t pos = (w << 6) | __builtin_ctzll(bits[w]);
+            bits[w] &= bits[w]-1;
+            if(!posset_add(arena, newstate, pos))
+                return false;
         }
-        i = i->next;
-        j = j->next;
+    }
+    return true;
+}
+
+// number of the state equal to set, a new state is added if there is no such one
+static long dfa_state_num(dfa_build_t *b, posset_t *set) {
+    dfa_t *dfa = b->dfa;
+    state_int_t key_node, *found_node;
+
+    key_node.state = *set;
+    found_node = (state_int_t*)htable_lookup(b->htable, (hnode_t*)&key_node);
+    if(found_node)
+        return found_node->val;
+
+    if(dfa->num_states > INT_MAX) {
+        fprintf(stderr, "DFA has more than %d states\n", INT_MAX);
+        return -1;
+    }
+
+    if(dfa->num_states == dfa->max_states) {
+        posset_t *tmp = arena_realloc(b->arena, b->states, dfa->max_states*sizeof(posset_t), (dfa->max_states<<1)*sizeof(posset_t));
+        if(!tmp)
+            return -1;
+        b->states = tmp;
+        if(!dfa_states_reserve(b->arena, dfa, dfa->max_states<<1))
+            return -1;
     }
 
-    return is_eq;
+    // the state owns a copy, set is reused by the caller
+    posset_t *state = &b->states[dfa->num_states];
+    *state = (posset_t){0};
+    if(!posset_copy(b->arena, state, set))
+        return -1;
+    if(!dfa_target_insert(b->arena, dfa, state_target(b->st, state)))
+        return -1;
+
+    key_node.state = *state;
+    key_node.val = dfa->num_states;
+    if(!htable_insert(b->htable, (hnode_t*)&key_node))
+        return -1;
+    return dfa->num_states++;
 }
 
-static inline bool dfa_target_insert(dfa_t *dfa, void *target) {
-    if(dfa->num_targets == dfa->max_targets) {
-        dfa->max_targets <<= 1;
-        void **newtargets = realloc(dfa->targets, sizeof(void*)*dfa->max_targets);
-        if(!newtargets) {
-            perror("realloc");
-            return false;
+static bool dfa_build_seq(dfa_build_t *b) {
+    dfa_t *dfa = b->dfa;
+    posset_t newstate = {0};
+    long state_num;
+    uint64_t *bits = arena_calloc(b->arena, (b->st->num_syms + b->st->num_ends + 63) >> 6, sizeof(uint64_t));
+    if(!bits)
+        return false;
+
+    for(size_t cur_state = 0; cur_state < dfa->num_states; cur_state++) {
+        for(size_t cls = 0; cls < dfa->num_classes; cls++) {
+            if(!dfa_successor(b->arena, b->st, bits, &b->states[cur_state], cls, &newstate))
+                return false;
+            if(newstate.num_items == 0)
+                continue;
+            if((state_num = dfa_state_num(b, &newstate)) < 0)
+                return false;
+            dfa->states[cur_state*dfa->num_classes + cls] = state_num;
         }
-        dfa->targets = newtargets;
     }
-    dfa->targets[dfa->num_targets++] = target;
     return true;
 }
 
-dfa_t* regexp_to_dfa(regexp_stat *st) {
-    dfa_t *dfa = NULL;
-    list_t *states = NULL;
-    htable_t *htable = NULL;
-    state_int_t st_key_node, *st_found_node;
-    sym_ptr_t pt_key_node, *pt_found_node;
-    int cur_state_ind = 0;
-    int new_state_ind = 1;
-    int state_num;
-    int end_state = st->num_syms;
-    size_t states_bytes;
+// Parallel construction goes level by level. Workers expand states of the
+// current level and look their successors up in the state table, which
+// isn't modified meanwhile. Successors which aren't found are added by one
+// thread in (state, class) order, so states are numbered exactly as in
+// dfa_build_seq.
+#define DFA_CHUNK 16
+
+typedef struct {
+    uint32_t state;
+    uint32_t cls;
+    posset_t set;
+} dfa_miss_t;
+
+typedef struct {
+    dfa_miss_t *misses;
+    size_t     num_misses, max_misses;
+} dfa_chunk_t;
+
+typedef struct {
+    dfa_build_t   *b;
+    size_t        begin, end;
+    size_t        num_chunks;
+    dfa_chunk_t   *chunks;
+    atomic_size_t next_chunk;
+} dfa_level_t;
+
+typedef struct {
+    dfa_level_t *lvl;
+    arena_t     *arena;
+    uint64_t    *bits;
+    bool        ok;
+    pthread_t   thread;
+} dfa_worker_t;
+
+static void* dfa_worker(void *arg) {
+    dfa_worker_t *w = arg;
+    dfa_level_t *lvl = w->lvl;
+    dfa_build_t *b = lvl->b;
+    size_t num_classes = b->dfa->num_classes;
+    posset_t newstate = {0};
+    state_int_t key_node, *found_node;
+
+    w->ok = false;
+    for(;;) {
+        size_t k = atomic_fetch_add(&lvl->next_chunk, 1);
+        if(k >= lvl->num_chunks)
+            break;
 
-    list_t *cpy, *newstate = NULL;
-    state_node_t *newnode;
+        dfa_chunk_t *chunk = &lvl->chunks[k];
+        size_t end = lvl->begin + (k+1)*DFA_CHUNK;
+        if(end > lvl->end)
+            end = lvl->end;
 
-    void *new_target;
-    bool prev_pred;
+        for(size_t s = lvl->begin + k*DFA_CHUNK; s < end; s++) {
+            for(size_t cls = 0; cls < num_classes; cls++) {
+                if(!dfa_successor(w->arena, b->st, w->bits, &b->states[s], cls, &newstate))
+                    return NULL;
+                if(newstate.num_items == 0)
+                    continue;
 
-    // init dfa
-    dfa = calloc(1, sizeof(dfa_t));
-    if(!dfa) {
-        perror("calloc");
-        goto exit;
+                key_node.state = newstate;
+                found_node = (state_int_t*)htable_lookup(b->htable, (hnode_t*)&key_node);
+                if(found_node) {
+                    b->dfa->states[s*num_classes + cls] = found_node->val;
+                    continue;
+                }
+
+                if(chunk->num_misses == chunk->max_misses) {
+                    size_t max_misses = chunk->max_misses ? chunk->max_misses << 1 : 8;
+                    dfa_miss_t *tmp = arena_realloc(w->arena, chunk->misses, chunk->max_misses*sizeof(dfa_miss_t), max_misses*sizeof(dfa_miss_t));
+                    if(!tmp)
+                        return NULL;
+                    chunk->misses = tmp;
+                    chunk->max_misses = max_misses;
+                }
+
+                // the miss owns the set until the level is merged
+                chunk->misses[chunk->num_misses++] = (dfa_miss_t){ s, cls, newstate };
+                newstate = (posset_t){0};
+            }
+        }
     }
-    states_bytes = sizeof(short) * (st->max_syms<<1) * 255;
-    dfa->states = malloc(states_bytes);
-    if(!dfa->states) {
-        perror("malloc");
-        goto exit;
+    w->ok = true;
+    return NULL;
+}
+
+static bool dfa_build_par(dfa_build_t *b, size_t num_threads) {
+    dfa_t *dfa = b->dfa;
+    dfa_level_t lvl;
+    dfa_worker_t *workers;
+    size_t num_words = (b->st->num_syms + b->st->num_ends + 63) >> 6;
+    long state_num;
+    bool ret = false;
+
+    workers = arena_calloc(b->arena, num_threads, sizeof(dfa_worker_t));
+    if(!workers)
+        return false;
+    for(size_t i = 0; i < num_threads; i++) {
+        workers[i].lvl = &lvl;
+        workers[i].bits = arena_calloc(b->arena, num_words, sizeof(uint64_t));
+        if(!workers[i].bits)
+            goto exit;
+        workers[i].arena = arena_create(1 << 16);
+        if(!workers[i].arena)
+            goto exit;
+    }
+
+    lvl.b = b;
+    lvl.begin = 0;
+    while(lvl.begin < dfa->num_states) {
+        lvl.end = dfa->num_states;
+        lvl.num_chunks = (lvl.end - lvl.begin + DFA_CHUNK-1) / DFA_CHUNK;
+        lvl.chunks = arena_calloc(b->arena, lvl.num_chunks, sizeof(dfa_chunk_t));
+        if(!lvl.chunks)
+            goto exit;
+        atomic_init(&lvl.next_chunk, 0);
+
+        size_t num_workers = num_threads < lvl.num_chunks ? num_threads : lvl.num_chunks;
+        for(size_t i = 0; i < num_workers; i++)
+            arena_reset(workers[i].arena);
+
+        // chunks are taken on demand, so if a thread can't be started
+        // the others do its work
+        for(size_t i = 1; i < num_workers; i++) {
+            if(pthread_create(&workers[i].thread, NULL, dfa_worker, &workers[i]) != 0) {
+                num_workers = i;
+                break;
+            }
+        }
+        dfa_worker(&workers[0]);
+
+        bool ok = workers[0].ok;
+        for(size_t i = 1; i < num_workers; i++) {
+            pthread_join(workers[i].thread, NULL);
+            ok = ok && workers[i].ok;
+        }
+        if(!ok)
+            goto exit;
+
+        for(size_t k = 0; k < lvl.num_chunks; k++) {
+            dfa_chunk_t *chunk = &lvl.chunks[k];
+            for(size_t i = 0; i < chunk->num_misses; i++) {
+                dfa_miss_t *miss = &chunk->misses[i];
+                if((state_num = dfa_state_num(b, &miss->set)) < 0)
+                    goto exit;
+                dfa->states[miss->state*dfa->num_classes + miss->cls] = state_num;
+            }
+        }
+
+        lvl.begin = lvl.end;
     }
-    memset(dfa->states, 0, states_bytes);
 
-    // create states list
-    states = list_create(NULL, state_node_free);
-    if(!states)
+    ret = true;
+exit:
+    for(size_t i = 0; i < num_threads; i++) {
+        if(workers[i].arena) arena_free(workers[i].arena);
+    }
+    return ret;
+}
+
+dfa_t* regexp_to_dfa(arena_t *arena, regexp_stat *st, size_t num_threads) {
+    dfa_build_t b = { arena, st, NULL, NULL, NULL };
+    dfa_t *dfa;
+    bool ok;
+
+    // init dfa
+    dfa = arena_calloc(arena, 1, sizeof(dfa_t));
+    if(!dfa)
         goto exit;
-    cpy = list_copy(st->firstpos);
-    if(!cpy)
+    b.dfa = dfa;
+    memcpy(dfa->classes, st->classes, sizeof(dfa->classes));
+    dfa->num_classes = st->num_classes;
+    if(!dfa_states_reserve(arena, dfa, 8))
         goto exit;
-    newnode = state_node_create(cpy);
-    if(!newnode)
+
+    // create states array, the start state is never looked up because
+    // 0 in the transition table means "no transition"
+    b.states = arena_alloc(arena, dfa->max_states*sizeof(posset_t));
+    if(!b.states)
+        goto exit;
+    b.states[0] = (posset_t){0};
+    dfa->num_states = 1;
+    if(!posset_copy(arena, &b.states[0], &st->firstpos))
         goto exit;
-    list_append(states, newnode);
 
     // create targets array
     dfa->max_targets = 8;
     dfa->num_targets = 1;
-    dfa->targets = malloc(sizeof(void*)*dfa->max_targets);
-    if(!dfa->targets) {
-        perror("malloc");
+    dfa->targets = arena_alloc(arena, sizeof(void*)*dfa->max_targets);
+    if(!dfa->targets)
         goto exit;
-    }
     dfa->targets[0] = NULL;
 
     // init htable
-    htable = htable_create(sizeof(state_int_t), st->num_syms, state_int_hash, state_int_keyeq, NULL);
-    if(!htable)
+    b.htable = htable_create(sizeof(state_int_t), st->num_syms, state_int_hash, state_int_keyeq, NULL);
+    if(!b.htable)
         goto exit;
 
-    state_node_t *cur_state_node = (state_node_t*)states->first;
-    for(;;) {
-        if(!cur_state_node)
-            break;
+    ok = num_threads > 1 ? dfa_build_par(&b, num_threads) : dfa_build_seq(&b);
+    if(!ok)
+        goto exit;
 
-        for(int c = 0; c <= 255; c++) {
-            if(!newstate) {
-                newstate = list_create(sym_node_copy, NULL);
-                if(!newstate)
-                    goto exit;
+    htable_free(b.htable);
+    return dfa;
+exit:
+    if(b.htable) htable_free(b.htable);
+    return NULL;
+}
+
+typedef struct {
+    int       grp;
+    uintptr_t target;
+    size_t    state;
+} min_key_t;
+
+static int min_key_cmp(const void *_k1, const void *_k2) {
+    const min_key_t *k1 = _k1;
+    const min_key_t *k2 = _k2;
+    if(k1->grp != k2->grp)
+        return k1->grp < k2->grp ? -1 : 1;
+    if(k1->target != k2->target)
+        return k1->target < k2->target ? -1 : 1;
+    if(k1->state != k2->state)
+        return k1->state < k2->state ? -1 : 1;
+    return 0;
+}
+
+// Hopcroft's partition refinement. State 0 is the start state and 0 in the
+// transition table means "no transition", so the start state always keeps its
+// own block and an extra dead state (index num_states) stands for the zeros.
+bool dfa_minimize(arena_t *arena, dfa_t *dfa, size_t *removed) {
+    size_t n = dfa->num_states + 1, dead = dfa->num_states;
+    size_t k = dfa->num_classes;
+    size_t *inv_start, *inv_src;
+    size_t *elems, *loc, *blk, *splitter;
+    size_t *bfirst, *bmid, *bend;
+    size_t *work, *touched, *newind;
+    bool *in_work;
+    min_key_t *keys;
+    uint32_t *newstates;
+    void **newtargets;
+    size_t num_blocks = 0, num_work = 0, num_touched;
+    bool ret = false;
+
+    // scratch memory lives until the end of minimization only
+    arena_t *tmp = arena_create(1 << 16);
+    if(!tmp)
+        return false;
+
+    // inverse transitions grouped by symbol and destination
+    inv_start = arena_calloc(tmp, k*n+1, sizeof(size_t));
+    inv_src = arena_alloc(tmp, k*n*sizeof(size_t));
+    if(!inv_start || !inv_src)
+        goto exit;
+    for(size_t s = 0; s < n; s++) {
+        for(size_t c = 0; c < k; c++) {
+            size_t t = s == dead || !dfa->states[s*k + c] ? dead : dfa->states[s*k + c];
+            inv_start[c*n + t + 1]++;
+        }
+    }
+    for(size_t i = 1; i <= k*n; i++)
+        inv_start[i] += inv_start[i-1];
+    for(size_t s = 0; s < n; s++) {
+        for(size_t c = 0; c < k; c++) {
+            size_t t = s == dead || !dfa->states[s*k + c] ? dead : dfa->states[s*k + c];
+            inv_src[inv_start[c*n + t]++] = s;
+        }
+    }
+    for(size_t i = k*n; i > 0; i--)
+        inv_start[i] = inv_start[i-1];
+    inv_start[0] = 0;
+
+    elems = arena_alloc(tmp, n*sizeof(size_t));
+    loc = arena_alloc(tmp, n*sizeof(size_t));
+    blk = arena_calloc(tmp, n, sizeof(size_t));
+    splitter = arena_alloc(tmp, n*sizeof(size_t));
+    bfirst = arena_alloc(tmp, n*sizeof(size_t));
+    bmid = arena_alloc(tmp, n*sizeof(size_t));
+    bend = arena_alloc(tmp, n*sizeof(size_t));
+    work = arena_alloc(tmp, n*sizeof(size_t));
+    touched = arena_alloc(tmp, n*sizeof(size_t));
+    in_work = arena_calloc(tmp, n, sizeof(bool));
+    keys = arena_alloc(tmp, n*sizeof(min_key_t));
+    if(!elems || !loc || !blk || !splitter || !bfirst || !bmid || !bend ||
+       !work || !touched || !in_work || !keys)
+        goto exit;
+
+    // initial partition: start state, states without target, one block per target
+    for(size_t s = 0; s < n; s++) {
+        void *target = s == dead ? NULL : dfa->targets[s];
+        keys[s].grp = s == 0 ? 0 : (target ? 2 : 1);
+        keys[s].target = (uintptr_t)target;
+        keys[s].state = s;
+    }
+    qsort(keys, n, sizeof(min_key_t), min_key_cmp);
+    for(size_t i = 0; i < n; i++) {
+        if(i == 0 || keys[i].grp != keys[i-1].grp || keys[i].target != keys[i-1].target) {
+            bfirst[num_blocks] = bmid[num_blocks] = i;
+            in_work[num_blocks] = true;
+            work[num_work++] = num_blocks;
+            num_blocks++;
+        }
+        bend[num_blocks-1] = i+1;
+        elems[i] = keys[i].state;
+        loc[keys[i].state] = i;
+        blk[keys[i].state] = num_blocks-1;
+    }
+
+    while(num_work > 0) {
+        size_t b = work[--num_work];
+        size_t spl_len = bend[b] - bfirst[b];
+        in_work[b] = false;
+        memcpy(splitter, elems + bfirst[b], spl_len*sizeof(size_t));
+
+        for(size_t c = 0; c < k; c++) {
+            num_touched = 0;
+            for(size_t i = 0; i < spl_len; i++) {
+                size_t t = splitter[i];
+                for(size_t j = inv_start[c*n + t]; j < inv_start[c*n + t + 1]; j++) {
+                    size_t s = inv_src[j];
+                    size_t y = blk[s];
+                    if(loc[s] < bmid[y])
+                        continue;
+                    if(bmid[y] == bfirst[y])
+                        touched[num_touched++] = y;
+                    size_t other = elems[bmid[y]];
+                    elems[loc[s]] = other;
+                    loc[other] = loc[s];
+                    elems[bmid[y]] = s;
+                    loc[s] = bmid[y];
+                    bmid[y]++;
+                }
             }
-            new_target = NULL;
-            prev_pred = false;
-            list_for_each(i, sym_node_t, cur_state_node->state) {
-                if((!i->t->sym.pred && i->t->sym.chr != c) ||
-                   (i->t->sym.pred && !i->t->sym.pred(c)))
-                    continue;
-                
-                cpy = list_copy(st->followpos[i->ind]);
-                if(!cpy)
-                    goto exit;
 
-                if(!new_target || (prev_pred && !i->t->sym.pred)) {
-                    prev_pred = i->t->sym.pred != NULL;
-                    list_for_each(j, sym_node_t, cpy) {
-                        if(j->ind >= end_state) {
-                            pt_key_node.s = i->t;
-                            pt_found_node = (sym_ptr_t*)htable_lookup(st->regexp_ptrs, (hnode_t*)&pt_key_node);
-                            if(!pt_found_node)
-                                goto exit;
-                            new_target = pt_found_node->ptr;
-                            break;
-                        }
-                    }
+            for(size_t i = 0; i < num_touched; i++) {
+                size_t y = touched[i];
+                if(bmid[y] == bend[y]) {
+                    bmid[y] = bfirst[y];
+                    continue;
                 }
 
-                newstate = list_union(newstate, cpy);
-            }
-            if(!newstate->first) {
-                if(c == 255) {
-                    list_free(newstate);
-                    newstate = NULL;
+                size_t z = num_blocks++;
+                bfirst[z] = bmid[z] = bfirst[y];
+                bend[z] = bmid[y];
+                bfirst[y] = bmid[y];
+                for(size_t j = bfirst[z]; j < bend[z]; j++)
+                    blk[elems[j]] = z;
+
+                if(in_work[y] || bend[z]-bfirst[z] <= bend[y]-bfirst[y]) {
+                    in_work[z] = true;
+                    work[num_work++] = z;
+                } else {
+                    in_work[y] = true;
+                    work[num_work++] = y;
                 }
-                continue;
-            }
-            st_key_node.state = newstate;
-            st_key_node.hash = state_int_hash((hnode_t*)&st_key_node);
-            st_found_node = (state_int_t*)htable_lookup(htable, (hnode_t*)&st_key_node);
-            if(!st_found_node) {
-                // append state into targets if it contains end_state
-                if(!dfa_target_insert(dfa, new_target))
-                    goto exit;
-                newnode = state_node_create(newstate);
-                if(!newnode)
-                    goto exit;
-                list_append(states, newnode);
-                st_key_node.val = new_state_ind;
-                if(!htable_insert(htable, (hnode_t*)&st_key_node))
-                    goto exit;
-                state_num = new_state_ind;
-                new_state_ind++;
-            } else {
-                state_num = st_found_node->val;
-                list_free(newstate);
             }
-            dfa->states[cur_state_ind*255 + c] = state_num;
-            newstate = NULL;
         }
+    }
 
-        cur_state_node = cur_state_node->next;
-        cur_state_ind++;
+    // number blocks by their smallest state, the dead block maps to 0
+    newind = arena_alloc(tmp, num_blocks*sizeof(size_t));
+    if(!newind)
+        goto exit;
+    for(size_t i = 0; i < num_blocks; i++)
+        newind[i] = SIZE_MAX;
+    newind[blk[dead]] = 0;
+
+    size_t num_states = 0;
+    for(size_t s = 0; s < dead; s++) {
+        if(newind[blk[s]] == SIZE_MAX) {
+            newind[blk[s]] = num_states;
+            splitter[num_states++] = s;
+        }
     }
 
-    dfa->num_states = cur_state_ind;
-    list_free(states);
-    htable_free(htable);
-    return dfa;
-exit:
-    if(dfa) {
-        if(dfa->states) free(dfa->states);
-        if(dfa->targets) free(dfa->targets);
-        free(dfa);
-    }
-    if(newstate) list_free(newstate);
-    if(states) list_free(states);
-    if(htable) htable_free(htable);
-    return NULL;
-}
+    newstates = arena_alloc(arena, num_states*k*sizeof(uint32_t));
+    newtargets = arena_alloc(arena, num_states*sizeof(void*));
+    if(!newstates || !newtargets)
+        goto exit;
+    for(size_t i = 0; i < num_states; i++) {
+        size_t s = splitter[i];
+        for(size_t c = 0; c < k; c++) {
+            uint32_t t = dfa->states[s*k + c];
+            newstates[i*k + c] = t ? newind[blk[t]] : 0;
+        }
+        newtargets[i] = dfa->targets[s];
+    }
 
-void dfa_free(dfa_t *dfa) {
-    free(dfa->states);
-    free(dfa->targets);
-    free(dfa);
+    *removed = dfa->num_states - num_states;
+    dfa->states = newstates;
+    dfa->targets = newtargets;
+    dfa->num_states = dfa->max_states = num_states;
+    dfa->num_targets = dfa->max_targets = num_states;
+    ret = true;
+exit:
+    arena_free(tmp);
+    return ret;
 }
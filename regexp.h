@@ -3,17 +3,26 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include "llist.h"
+#include "posset.h"
 #include "htable.h"
+#include "arena.h"
 
-typedef bool (*chr_pred)(char);
+// set of bytes matched by a SYM leaf
+typedef struct {
+    uint64_t bits[4];
+} charset_t;
+
+static inline bool charset_has(const charset_t *set, unsigned char c) {
+    return set->bits[c >> 6] & (1ULL << (c & 63));
+}
 
 typedef struct syn_tree {
-    enum { SYM, OR, AND, STAR } tag;
+    enum { SYM, OR, AND, STAR, PLUS, QUEST } tag;
     union {
         struct {
-            char chr;
-            chr_pred pred;
+            charset_t set;
+            // a byte of a code point class, never ends a rule as a literal
+            bool      in_class;
         } sym;
         struct {
             struct syn_tree *s1;
@@ -25,33 +34,35 @@ typedef struct syn_tree {
         } and;
         struct {
             struct syn_tree *s;
-        } star;
+        } star, plus, quest;
     };
 } syn_tree_t;
 
 void print_syn_tree(syn_tree_t *s);
-void syn_tree_free(syn_tree_t *s);
-syn_tree_t* parse_regexp(const char *regexp, size_t len, size_t *off, bool *error);
-syn_tree_t* regexp_ext(syn_tree_t *s1);
-
-typedef struct sym_node_s {
-    struct sym_node_s *next;
-    syn_tree_t        *t;
-    size_t            ind;
-} sym_node_t;
+syn_tree_t* parse_regexp(arena_t *arena, const char *regexp, size_t len, size_t *off, bool *error);
 
+// Positions are numbered SYM leaves. Every rule gets two end markers with
+// numbers num_syms+m: markers of rules whose last symbol matches a single
+// character come first, then markers of rules ending with a character class,
+// both in rule order. The smallest marker in a DFA state selects its target.
 typedef struct {
-    list_t   *firstpos;
-    list_t   *lastpos;
-    list_t   **followpos;
-    htable_t *regexp_ptrs;
-    bool     nullable;
-    size_t   num_syms, max_syms;
+    arena_t    *arena;
+    posset_t   firstpos;
+    posset_t   lastpos;
+    posset_t   *followpos;
+    syn_tree_t **syms;
+    uint64_t   (*sym_classes)[4];
+    void       **end_targets;
+    size_t     num_ends;
+    htable_t   *regexp_ptrs;
+    bool       nullable;
+    size_t     num_syms, max_syms;
+    // bytes which every SYM treats the same way share one class
+    unsigned char classes[256];
+    size_t        num_classes;
 } regexp_stat;
 
-regexp_stat* get_regexp_stat(syn_tree_t *ext, htable_t *regexp_ptrs);
-void free_regexp_stat(regexp_stat *st);
-syn_tree_t* regexp_ext(syn_tree_t *s1);
+regexp_stat* get_regexp_stat(arena_t *arena, syn_tree_t *root, htable_t *regexp_ptrs);
 
 typedef struct {
     uint32_t   hash;
@@ -62,22 +73,19 @@ htable_t* sym_ptr_htable_init();
 bool regexp_assoc_ptr(htable_t *htable, syn_tree_t *s, void *ptr);
 
 typedef struct {
-    unsigned short *states;
+    uint32_t       *states;
     void           **targets;
-    size_t         num_states;
+    size_t         num_states, max_states;
     size_t         max_targets, num_targets;
+    unsigned char  classes[256];
+    size_t         num_classes;
 } dfa_t;
 
-typedef struct state_node_s {
-    struct state_node_s *next;
-    list_t              *state;
-} state_node_t;
-
 typedef struct {
     uint32_t hash;
-    list_t   *state;
+    posset_t state;
     int      val;
 } state_int_t;
 
-dfa_t* regexp_to_dfa(regexp_stat *st);
-void dfa_free(dfa_t *dfa);
+dfa_t* regexp_to_dfa(arena_t *arena, regexp_stat *st, size_t num_threads);
+bool dfa_minimize(arena_t *arena, dfa_t *dfa, size_t *removed);
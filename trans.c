@@ -19,20 +19,14 @@ static bool unit_node_keyeq(hnode_t *_n1, hnode_t *_n2) {
     return !strcmp(n1->title, n2->title);
 }
 
-static void unit_node_free(hnode_t *_n) {
-    unit_node_t *n = (unit_node_t*)_n;
-    free(n->title);
-    free(n->content);
-}
-
-htable_t* parse_trans_file(const char *filename) {
+htable_t* parse_trans_file(arena_t *arena, const char *filename) {
     htable_t *htable = NULL;
     unit_node_t key_node;
     int fd = -1;
-    char buf[4096], *bufptr, *title = NULL, *content = NULL;
-    size_t max_bytes = 0, cur_bytes = 0;
+    char *buf = NULL, *bufptr, *title = NULL, *content = NULL;
+    size_t max_bytes = 0, cur_bytes = 0, max_buf = 4096;
 
-    htable = htable_create(sizeof(unit_node_t), 3, unit_node_hash, unit_node_keyeq, unit_node_free);
+    htable = htable_create(sizeof(unit_node_t), 3, unit_node_hash, unit_node_keyeq, NULL);
     if(!htable)
         goto exit;
 
@@ -42,113 +36,119 @@ htable_t* parse_trans_file(const char *filename) {
         goto exit;
     }
 
-    ssize_t nbytes, res_len;
+    // section end is detected by the terminating zero, so the parser
+    // needs the whole file at once
+    buf = arena_alloc(arena, max_buf);
+    if(!buf)
+        goto exit;
+
+    ssize_t nbytes = 0, res_len, len;
+    while((len = read(fd, buf+nbytes, max_buf-nbytes)) > 0) {
+        nbytes += len;
+        if(nbytes == max_buf) {
+            char *tmp = arena_realloc(arena, buf, max_buf, max_buf<<1);
+            if(!tmp)
+                goto exit;
+            buf = tmp;
+            max_buf <<= 1;
+        }
+    }
+    if(len < 0) {
+        perror("read");
+        goto exit;
+    }
+
     bool title_reading = false, prev_nl = false;
-    do {
-        nbytes = read(fd, buf, sizeof(buf));
-        if(nbytes < 0) {
-            perror("read");
-            goto exit;
+    bufptr=buf;
+    res_len=nbytes;
+
+    while(res_len > 0) {
+        if(!title) {
+            if(bufptr[0] != '[') {
+                fputs("Failed to read title, expected [\n", stderr);
+                goto exit;
+            }
+            max_bytes = 8;
+            cur_bytes = 0;
+            title = arena_alloc(arena, max_bytes);
+            if(!title)
+                goto exit;
+            title_reading = true;
+            bufptr++; res_len--;
+        } else if(!content && !title_reading) {
+            if(bufptr[0] != '\n') {
+                fputs("Expected \\n after title\n", stderr);
+                goto exit;
+            }
+            max_bytes = 8;
+            cur_bytes = 0;
+            content = arena_alloc(arena, max_bytes);
+            if(!content)
+                goto exit;
+            bufptr++; res_len--;
         }
-        bufptr=buf;
-        res_len=nbytes;
 
-        while(res_len > 0) {
-            if(!title) {
-                if(bufptr[0] != '[') {
-                    fputs("Failed to read title, expected [\n", stderr);
-                    goto exit;
-                }
-                max_bytes = 8;
-                cur_bytes = 0;
-                title = malloc(max_bytes);
-                if(!title) {
-                    perror("malloc");
-                    goto exit;
-                }
-                title_reading = true;
-                bufptr++; res_len--;
-            } else if(!content && !title_reading) {
-                if(bufptr[0] != '\n') {
-                    fputs("Expected \\n after title\n", stderr);
+        for( ; res_len >= 0; res_len--) {
+            char c;
+            if(res_len > 0)
+                c = *bufptr++;
+            else
+                c = 0;
+            char *rb, **rbptr;
+            if(title_reading) {
+                rb = title;
+                rbptr = &title;
+                if(c == ']') {
+                    c = 0;
+                    title_reading = false;
+                } else if(c < 'A' || (c > 'Z' && c < 'a') || c > 'z') {
+                    fprintf(stderr, "%c is illegal character in title\n", c);
                     goto exit;
-                }
-                max_bytes = 8;
-                cur_bytes = 0;
-                content = malloc(max_bytes);
-                if(!content) {
-                    perror("malloc");
+                } 
+            } else {
+                rb = content;
+                rbptr = &content;
+                if(c == '[' && prev_nl) {
+                    c = 0;
+                    bufptr--; res_len++;
+                } else if(((unsigned char)c < 33 || c == 127) && c != ' ' && c != '\n' && c != '\t' && c != '\r' && res_len != 0) {
+                    fprintf(stderr, "\\x%02x is illegal character in content\n", (unsigned char)c);
                     goto exit;
                 }
-                bufptr++; res_len--;
             }
 
-            for( ; res_len >= 0; res_len--) {
-                char c;
-                if(res_len > 0)
-                    c = *bufptr++;
-                else
-                    c = 0;
-                char *rb, **rbptr;
-                if(title_reading) {
-                    rb = title;
-                    rbptr = &title;
-                    if(c == ']') {
-                        c = 0;
-                        title_reading = false;
-                    } else if(c < 'A' || (c > 'Z' && c < 'a') || c > 'z') {
-                        fprintf(stderr, "%c is illegal character in title\n", c);
+            if(cur_bytes == max_bytes) {
+                char *tmp = arena_realloc(arena, rb, max_bytes, max_bytes<<1);
+                if(!tmp)
+                    goto exit;
+                max_bytes <<= 1;
+                *rbptr = tmp;
+                rb = tmp;
+            }
+            rb[cur_bytes++] = c;
+            if(c == 0) {
+                if(content) {
+                    key_node.content = content;
+                    key_node.content_len = cur_bytes-1;
+                    if(!htable_insert(htable, (hnode_t*)&key_node))
                         goto exit;
-                    } 
+                    title = content = NULL;
                 } else {
-                    rb = content;
-                    rbptr = &content;
-                    if(c == '[' && prev_nl) {
-                        c = 0;
-                        bufptr--; res_len++;
-                    } else if((c < 33 || c >= 127) && c != ' ' && c != '\n' && c != '\t' && c != '\r' && res_len != 0) {
-                        fprintf(stderr, "\\x%02x is illegal character in content\n", (unsigned char)c);
-                        goto exit;
-                    }
-                }
-
-                if(cur_bytes == max_bytes) {
-                    max_bytes <<= 1;
-                    char *tmp = realloc(rb, max_bytes);
-                    if(!tmp) {
-                        perror("realloc");
-                        goto exit;
-                    }
-                    *rbptr = tmp;
-                    rb = tmp;
+                    key_node.title = title;
+                    key_node.title_len = cur_bytes-1;
                 }
-                rb[cur_bytes++] = c;
-                if(c == 0) {
-                    if(content) {
-                        key_node.content = content;
-                        key_node.content_len = cur_bytes-1;
-                        if(!htable_insert(htable, (hnode_t*)&key_node))
-                            goto exit;
-                        title = content = NULL;
-                    } else {
-                        key_node.title = title;
-                        key_node.title_len = cur_bytes-1;
-                    }
-                    res_len--;
-                    break;
-                }
-                prev_nl = c == '\n';
+                res_len--;
+                break;
             }
+            prev_nl = c == '\n';
         }
-    } while(nbytes == sizeof(buf));
+    }
 
     close(fd);
     return htable;
 exit:
     if(htable) htable_free(htable);
     if(fd >= 0) close(fd);
-    if(title) free(title);
-    if(content) free(content);
     return NULL;
 }
 
@@ -172,7 +172,7 @@ bool check_trans_units(htable_t *htable) {
     return true;
 }
 
-regexp_func_t* parse_regexes(const char *str, size_t len, size_t *_num_funcs) {
+regexp_func_t* parse_regexes(arena_t *arena, const char *str, size_t len, size_t *_num_funcs) {
     size_t num_funcs=0, max_funcs = 8, cur_bytes, max_bytes;
     char *regexp = NULL, *func = NULL, *rb, **rbptr;
     regexp_func_t *funcs = NULL;
@@ -180,11 +180,9 @@ regexp_func_t* parse_regexes(const char *str, size_t len, size_t *_num_funcs) {
     size_t regexp_len;
     int nested;
 
-    funcs = malloc(sizeof(regexp_func_t)*max_funcs);
-    if(!funcs) {
-        perror("malloc");
-        goto exit;
-    }
+    funcs = arena_alloc(arena, sizeof(regexp_func_t)*max_funcs);
+    if(!funcs)
+        return NULL;
 
     char prev = 0;
     for( ; len > 0; len--) {
@@ -197,15 +195,13 @@ regexp_func_t* parse_regexes(const char *str, size_t len, size_t *_num_funcs) {
                 break;
             if(str[0] != '"') {
                 fprintf(stderr, "Expected \" before regexp, but get '%c'\n", str[0]);
-                goto exit;
+                return NULL;
             }
             max_bytes = 8;
             cur_bytes = 0;
-            regexp = malloc(max_bytes);
-            if(!regexp) {
-                perror("malloc");
-                goto exit;
-            }
+            regexp = arena_alloc(arena, max_bytes);
+            if(!regexp)
+                return NULL;
             regex_reading = true;
             str++; len--;
         } else if(!func && !regex_reading) {
@@ -215,19 +211,17 @@ regexp_func_t* parse_regexes(const char *str, size_t len, size_t *_num_funcs) {
             }
             if(len == 0) {
                 fputs("Unexpected end of file: expected function after regexp\n", stderr);
-                goto exit;
+                return NULL;
             }
             if(*str != '{') {
                 fprintf(stderr, "Expected { after regexp, but get '%c'\n", *str);
-                goto exit;
+                return NULL;
             }
             max_bytes = 8;
             cur_bytes = 0;
-            func = malloc(max_bytes);
-            if(!func) {
-                perror("malloc");
-                goto exit;
-            }
+            func = arena_alloc(arena, max_bytes);
+            if(!func)
+                return NULL;
             nested = 0;
         }
 
@@ -253,12 +247,10 @@ regexp_func_t* parse_regexes(const char *str, size_t len, size_t *_num_funcs) {
         }
 
         if(cur_bytes == max_bytes) {
+            char *tmp = arena_realloc(arena, rb, max_bytes, max_bytes<<1);
+            if(!tmp)
+                return NULL;
             max_bytes <<= 1;
-            char *tmp = realloc(rb, max_bytes);
-            if(!tmp) {
-                perror("realloc");
-                goto exit;
-            }
             *rbptr = tmp;
             rb = tmp;
         }
@@ -268,13 +260,12 @@ regexp_func_t* parse_regexes(const char *str, size_t len, size_t *_num_funcs) {
         if(c == 0) {
             if(func) {
                 if(num_funcs == max_funcs) {
-                    max_funcs <<= 1;
-                    regexp_func_t *tmp = realloc(funcs, max_funcs*sizeof(regexp_func_t));
-                    if(!tmp) {
-                        perror("realloc");
-                        goto exit;
-                    }
+                    regexp_func_t *tmp = arena_realloc(arena, funcs, max_funcs*sizeof(regexp_func_t),
+                                                       (max_funcs<<1)*sizeof(regexp_func_t));
+                    if(!tmp)
+                        return NULL;
                     funcs = tmp;
+                    max_funcs <<= 1;
                 }
                 funcs[num_funcs++] = (regexp_func_t) {
                     .regexp = regexp,
@@ -291,15 +282,4 @@ regexp_func_t* parse_regexes(const char *str, size_t len, size_t *_num_funcs) {
 
     *_num_funcs = num_funcs;
     return funcs;
-exit:
-    if(funcs) {
-        for(size_t i = 0; i < num_funcs; i++) {
-            free(funcs[i].regexp);
-            free(funcs[i].func);
-        }
-        free(funcs);
-    }
-    if(regexp) free(regexp);
-    if(func) free(func);
-    return NULL;
 }
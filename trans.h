@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "htable.h"
+#include "arena.h"
 
 typedef struct {
     uint32_t hash;
@@ -12,7 +13,7 @@ typedef struct {
     size_t   content_len;
 } unit_node_t;
 
-htable_t* parse_trans_file(const char *filename);
+htable_t* parse_trans_file(arena_t *arena, const char *filename);
 bool check_trans_units(htable_t *htable);
 
 typedef struct {
@@ -22,4 +23,4 @@ typedef struct {
     size_t func_len;
 } regexp_func_t;
 
-regexp_func_t* parse_regexes(const char *str, size_t len, size_t *_num_funcs);
+regexp_func_t* parse_regexes(arena_t *arena, const char *str, size_t len, size_t *_num_funcs);